@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include "word_table.h"
+using namespace std;
+
+// Tokenization rules of this build (analyzer.bin records them)
+enum AnalyzerRule
+{
+    ANALYZER_SPLIT_DIGITS = 1, // Decimal digits separate tokens
+    ANALYZER_CASE_FOLD = 2,    // Tokens are case-folded
+    ANALYZER_UTF8 = 4          // Text is decoded as UTF-8 (Unicode spaces, digits, folding)
+};
+
+const uint32_t ANALYZER_MAGIC = 0x5A4C4E41; // "ANLZ"
+// Bump when the tokenizer or word_hash changes what a stored table means
+const uint32_t ANALYZER_VERSION = 1;
+const uint32_t ANALYZER_RULES = ANALYZER_SPLIT_DIGITS | ANALYZER_CASE_FOLD | ANALYZER_UTF8;
+
+// analyzer.bin layout (little-endian u32): magic, version, rules, then the
+// analyzer's WordTable (stopwords and operator words) as WordTable::write
+// lays it out
+inline void write_analyzer_file(const string &path, const WordTable &words)
+{
+    ofstream out(path, ios::binary);
+    uint32_t header[] = {ANALYZER_MAGIC, ANALYZER_VERSION, ANALYZER_RULES};
+    out.write(reinterpret_cast<const char *>(header), sizeof(header));
+    words.write(out);
+}
+
+// Read analyzer.bin; false if missing, damaged, or written for other rules
+inline bool read_analyzer_file(const string &path, WordTable &words)
+{
+    ifstream in(path, ios::binary);
+    uint32_t header[3];
+    if (!in.read(reinterpret_cast<char *>(header), sizeof(header)) || header[0] != ANALYZER_MAGIC ||
+        header[1] != ANALYZER_VERSION || header[2] != ANALYZER_RULES)
+        return false;
+    return words.read(in);
+}
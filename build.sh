@@ -21,7 +21,7 @@ echo ""
 
 # Task 1: Compile tokenize_corpus.cpp
 echo "[1/3] Compiling Task 1: Custom Tokenizer (tokenize_corpus.cpp)..."
-if g++ -std=c++11 -o "${SCRIPT_DIR}/tokenize_corpus" "${SCRIPT_DIR}/tokenize_corpus.cpp"; then
+if g++ -std=c++11 -pthread -o "${SCRIPT_DIR}/tokenize_corpus" "${SCRIPT_DIR}/tokenize_corpus.cpp"; then
     echo "✓ tokenize_corpus.cpp compiled successfully"
 else
     echo "✗ Error: tokenize_corpus.cpp compilation failed!"
@@ -31,7 +31,7 @@ echo ""
 
 # Tasks 2 & 3: Compile build_index.cpp (merged indexing and compression)
 echo "[2/3] Compiling Tasks 2 & 3: Inverted Index and Compression (build_index.cpp)..."
-if g++ -std=c++11 -o "${SCRIPT_DIR}/build_index" "${SCRIPT_DIR}/build_index.cpp"; then
+if g++ -std=c++11 -pthread -o "${SCRIPT_DIR}/build_index" "${SCRIPT_DIR}/build_index.cpp"; then
     echo "✓ build_index.cpp compiled successfully"
 else
     echo "✗ Error: build_index.cpp compilation failed!"
@@ -41,7 +41,7 @@ echo ""
 
 # Task 4: Compile retrieval.cpp
 echo "[3/3] Compiling Task 4: Boolean Retrieval (retrieval.cpp)..."
-if g++ -std=c++11 -o "${SCRIPT_DIR}/retrieval" "${SCRIPT_DIR}/retrieval.cpp"; then
+if g++ -std=c++11 -pthread -o "${SCRIPT_DIR}/retrieval" "${SCRIPT_DIR}/retrieval.cpp"; then
     echo "✓ retrieval.cpp compiled successfully"
 else
     echo "✗ Error: retrieval.cpp compilation failed!"
@@ -61,9 +61,9 @@ if [ "$OVERALL_SUCCESS" = true ]; then
     echo "  - ./retrieval          (Task 4: Boolean Retrieval)"
     echo ""
     echo "Available shell scripts:"
-    echo "  - ./tokenize_corpus.sh <CORPUS_DIR> <STOPWORDS_FILE> <VOCAB_DIR>"
-    echo "  - ./build_index.sh     <CORPUS_DIR> <VOCAB_PATH> <INDEX_DIR> <COMPRESSED_DIR>"
-    echo "  - ./retrieval.sh       <COMPRESSED_DIR> <QUERY_FILE_PATH> <OUTPUT_DIR>"
+    echo "  - ./tokenize_corpus.sh <CORPUS_DIR> <STOPWORDS_FILE> <VOCAB_DIR> [--threads=N] [--min-df=N] [--max-df=FRACTION]"
+    echo "  - ./build_index.sh     <CORPUS_DIR> <VOCAB_PATH> <INDEX_DIR> <COMPRESSED_DIR> [--biword-min-df=N] [--biword-queries=FILE] [--shards=N [--threads=N]]"
+    echo "  - ./retrieval.sh       <COMPRESSED_DIR> <QUERY_FILE_PATH> <OUTPUT_DIR> [--threads=N] [--query-threads=N] [--ranked [--top-k=N]] [--limit=N] [--count-only] [--format=docids|trec|binary] [--stdout] [--async-output] [--explain] [--profile]"
     echo ""
     echo "Build completed successfully. You can now run the individual task scripts."
     exit 0
@@ -11,6 +11,7 @@
 #include <set>
 #include <cstdint>
 #include <sstream>
+#include <utility>
 #ifdef _WIN32
 #include <direct.h>
 #include <io.h>
@@ -21,16 +22,47 @@
 #endif
 #include "tokenizer.h"
 #include "utilities.h"
+#include "ranking.h"
+#include "wildcard.h"
+#include "analyzer.h"
+#include "vocabulary.h"
+#include "parallel.h"
+#include "shards.h"
+#include "line_reader.h"
 
 using namespace std;
 
-unordered_set<string> load_vocab(const string &vocab_file)
+// Vocabulary terms with their collection statistics. A vocab.bin path is
+// read directly; for vocab.txt the terms come from the text file and their
+// df / cf from the vocab.bin beside it when there is one (zero otherwise).
+unordered_map<string, TermFrequency> load_vocab(const string &vocab_file)
 {
-    unordered_set<string> V;
+    unordered_map<string, TermFrequency> V;
+    Vocabulary vocabulary;
+    bool binary = vocab_file.size() >= 4 && vocab_file.compare(vocab_file.size() - 4, 4, ".bin") == 0;
+    if (binary)
+    {
+        if (!read_vocabulary_file(vocab_file, vocabulary))
+            cerr << "Error: Cannot read binary vocabulary: " << vocab_file << endl;
+        V.reserve(vocabulary.terms.size());
+        for (const VocabularyEntry &entry : vocabulary.terms)
+            V[entry.term] = entry.frequency;
+        return V;
+    }
+
+    string vocab_dir = vocab_file.substr(0, vocab_file.find_last_of("/\\"));
+    read_vocabulary_file(vocab_dir + "/vocab.bin", vocabulary);
+    V.reserve(vocabulary.terms.size());
     ifstream fin(vocab_file);
     string w;
     while (fin >> w)
-        V.insert(w);
+        V[w] = TermFrequency{0, 0};
+    for (const VocabularyEntry &entry : vocabulary.terms)
+    {
+        auto it = V.find(entry.term);
+        if (it != V.end())
+            it->second = entry.frequency;
+    }
     return V;
 }
 
@@ -63,6 +95,49 @@ string json_escape(const string &s)
     return out;
 }
 
+// Optional build features, set from command-line options
+struct BuildOptions
+{
+    uint32_t biword_min_df;               // Index adjacent term pairs found in at least this many docs (0 = off)
+    set<pair<string, string>> biword_log; // Also index the pairs of quoted phrases in a query log
+    uint32_t shards;                      // Document-partitioned shards (1 = a single index)
+    unsigned threads;                     // Threads building shards (0 = one per hardware thread)
+
+    BuildOptions() : biword_min_df(0), shards(1), threads(0) {}
+};
+
+BuildOptions global_build_options;
+
+// Set when a corpus file could not be read completely; no index is written
+bool global_corpus_failed = false;
+
+// BM25 statistics of the whole collection, which a sharded build scores
+// every shard with so merged rankings match the unsharded index (doc_count
+// 0 for a single index: it uses its own)
+struct CollectionStats
+{
+    uint64_t doc_count;
+    uint64_t token_count;
+    unordered_map<string, uint32_t> df;
+
+    CollectionStats() : doc_count(0), token_count(0) {}
+
+    // Average document length, as finish_ranking_stats computes it
+    double avg_doc_length() const { return doc_count == 0 ? 1.0 : max(1.0, (double)token_count / doc_count); }
+};
+
+CollectionStats global_collection_stats;
+
+// Log of the shard job running on this thread (null outside shard jobs)
+thread_local ostringstream *shard_log = nullptr;
+
+// Progress messages: standard output, or the shard's log inside a shard job
+// (printed in shard order once all are done, so lines do not interleave)
+ostream &status_stream()
+{
+    return shard_log ? *shard_log : cout;
+}
+
 // Type definition for inverted index as required by assignment
 typedef unordered_map<string, unordered_map<string, vector<int>>> inverted_index;
 
@@ -74,15 +149,131 @@ void save_index(inverted_index index, string index_dir);
 
 // Function to compress inverted index as required by assignment
 void compress_index(string path_to_index_file, string path_to_compressed_files_directory);
+void compress_parsed_index(const map<string, map<string, vector<uint32_t>>> &index,
+                           const string &path_to_index_file, const string &path_to_compressed_files_directory);
+bool load_index_json(const string &path, map<string, map<string, vector<uint32_t>>> &index);
 
 // Function to save compressed index as required by assignment
 void save_compressed_index(inverted_index index, string compressed_dir);
 
+// Write the query analyzer of the index to analyzer.bin
+void compress_analyzer(const string &vocab_path, const string &compressed_dir);
+
+// Partition the index by document and write each shard as a complete index
+void build_shards(inverted_index &index, const string &vocab_path, const string &index_dir,
+                  const string &compressed_dir);
+
+// Analyzer word table of an index: the stopwords of the vocab directory (set
+// up by Task 1) plus the query operator words. Indexing tokenizes with it and
+// analyzer.bin carries it to retrieval, so both sides drop the same words.
+WordTable load_analyzer_words(const string &vocab_path)
+{
+    string vocab_dir = vocab_path.substr(0, vocab_path.find_last_of("/\\"));
+    WordTable words;
+    add_operator_words(words);
+    add_stopwords(words, vocab_dir + "/stopwords.txt");
+    words.build();
+    return words;
+}
+
+// Adjacent term pairs of the quoted phrases in a query file (JSON lines with
+// a "title"), tokenized like the documents
+set<pair<string, string>> load_biword_query_log(const string &path, const WordTable &stopwords)
+{
+    set<pair<string, string>> pairs;
+    ifstream file(path);
+    if (!file.is_open())
+    {
+        cerr << "Warning: Cannot open bi-word query log: " << path << endl;
+        return pairs;
+    }
+
+    string line;
+    while (getline(file, line))
+    {
+        size_t key_pos = line.find("\"title\"");
+        size_t start = key_pos == string::npos ? string::npos : line.find('"', line.find(':', key_pos));
+        if (start == string::npos)
+            continue;
+
+        // Title up to the closing quote, with \" turned back into phrase quotes
+        string title;
+        for (size_t i = start + 1; i < line.size() && line[i] != '"'; i++)
+        {
+            if (line[i] == '\\' && i + 1 < line.size())
+                i++;
+            title += line[i];
+        }
+
+        // Every other segment between quotes is a phrase
+        istringstream segments(title);
+        string segment;
+        for (int k = 0; getline(segments, segment, '"'); k++)
+        {
+            if (k % 2 == 0)
+                continue;
+            vector<string> terms = tokenize(segment, stopwords);
+            for (size_t i = 0; i + 1 < terms.size(); i++)
+            {
+                pairs.insert(make_pair(terms[i], terms[i + 1]));
+            }
+        }
+    }
+    return pairs;
+}
+
+// Parse the optional flags after the four required arguments
+bool parse_build_options(int argc, char *argv[], int first, const string &vocab_file, BuildOptions &options)
+{
+    for (int i = first; i < argc; i++)
+    {
+        string option = argv[i];
+        string arg = option;
+        string value;
+        size_t eq = arg.find('=');
+        if (eq != string::npos)
+        {
+            value = arg.substr(eq + 1);
+            arg = arg.substr(0, eq);
+        }
+        else if (i + 1 < argc)
+        {
+            value = argv[++i];
+        }
+
+        uint64_t number = 0;
+        if (arg == "--biword-min-df" && parse_unsigned(value, UINT32_MAX, number))
+        {
+            options.biword_min_df = number;
+        }
+        else if (arg == "--shards" && parse_unsigned(value, MAX_SHARDS, number) && number > 0)
+        {
+            options.shards = number;
+        }
+        else if (arg == "--threads" && parse_unsigned(value, MAX_POOL_THREADS, number))
+        {
+            options.threads = number;
+        }
+        else if (arg == "--biword-queries" && !value.empty())
+        {
+            // Phrases must be tokenized with the stopwords the index uses
+            options.biword_log = load_biword_query_log(value, load_analyzer_words(vocab_file));
+        }
+        else
+        {
+            cerr << "Error: Unknown or invalid option: " << option << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
 int main(int argc, char *argv[])
 {
-    if (argc != 5)
+    if (argc < 5 || !parse_build_options(argc, argv, 5, argv[2], global_build_options))
     {
-        cerr << "Usage: " << argv[0] << " <corpus_dir> <vocab_file> <index_dir> <compressed_dir>" << endl;
+        cerr << "Usage: " << argv[0] << " <corpus_dir> <vocab_file> <index_dir> <compressed_dir>"
+             << " [--biword-min-df=N] [--biword-queries=QUERY_FILE] [--shards=N [--threads=N]]" << endl;
         return 1;
     }
 
@@ -97,6 +288,17 @@ int main(int argc, char *argv[])
 
     // Build the inverted index using required function
     auto index = build_index(corpus_dir, vocab_file);
+    if (global_corpus_failed)
+        return 1;
+
+    if (global_build_options.shards > 1)
+    {
+        build_shards(index, vocab_file, index_dir, compressed_dir);
+        return 0;
+    }
+
+    // A single index replaces a sharded one built here before
+    remove((compressed_dir + "/" + SHARD_MANIFEST).c_str());
 
     // Save the uncompressed index using required function
     save_index(index, index_dir);
@@ -105,6 +307,9 @@ int main(int argc, char *argv[])
     string index_json_path = index_dir + "/index.json";
     compress_index(index_json_path, compressed_dir);
 
+    // Analyzer for retrieval, so queries are tokenized like the documents
+    compress_analyzer(vocab_file, compressed_dir);
+
     return 0;
 }
 
@@ -114,18 +319,14 @@ inverted_index build_index(string collection_dir, string vocab_path)
 {
     auto V = load_vocab(vocab_path);
 
-    // Load stopwords from vocab directory (set up by Task 1)
-    unordered_set<string> stopwords;
-    string vocab_dir = vocab_path.substr(0, vocab_path.find_last_of("/\\"));
-    string stopwords_path = vocab_dir + "/stopwords.txt";
-
-    ifstream stopwords_file(stopwords_path);
-    if (stopwords_file.is_open())
-    {
-        stopwords = load_stopwords(stopwords_path);
-    }
+    // Stopwords from the vocab directory, as saved to analyzer.bin
+    WordTable stopwords = load_analyzer_words(vocab_path);
 
+    // Size the dictionary for the whole vocabulary up front; posting maps are
+    // sized from each term's df (and position lists from cf / df) when the
+    // term is first seen, so they do not rehash while the corpus streams in
     inverted_index index;
+    index.reserve(V.size());
 
     // Get all files in the collection directory
     vector<string> corpus_files = get_files_in_directory(collection_dir);
@@ -141,16 +342,24 @@ inverted_index build_index(string collection_dir, string vocab_path)
     {
         cerr << "Processing corpus file: " << corpus_file_path << endl;
         
-        // Open the corpus file
-        ifstream corpus_file(corpus_file_path);
-        if (!corpus_file.is_open())
+        // Open the corpus file (gzip / zstd files stream through a decompressor)
+        LineReader corpus_file;
+        if (!corpus_file.open(corpus_file_path))
         {
+            // A compressed file whose decompressor cannot start is lost input
+            if (corpus_file.compression() != COMPRESSION_NONE)
+            {
+                cerr << "Error: Cannot start decompressor for corpus file: " << corpus_file_path << endl;
+                global_corpus_failed = true;
+                return index;
+            }
             cerr << "Warning: Cannot open corpus file: " << corpus_file_path << ", skipping" << endl;
             continue;
         }
 
         string json_line;
-        while (getline(corpus_file, json_line))
+        string word; // Token buffer reused across documents
+        while (corpus_file.next_line(json_line))
         {
             if (json_line.empty())
                 continue;
@@ -163,26 +372,39 @@ inverted_index build_index(string collection_dir, string vocab_path)
                 continue;
             }
 
-            // Tokenize the content
-            auto tokens = tokenize(doc.content, stopwords);
+            // Tokenize the content straight from the line buffer
             cerr << "Doc: " << doc.doc_id << "\n";
             int pos = 0;
-            for (auto &tok : tokens)
-            {
-                cerr << "  token: [" << tok << "]";
-                if (V.find(tok) != V.end())
-                {
-                    index[tok][doc.doc_id].push_back(pos);
-                    cerr << " in vocab\n";
-                }
-                else
-                {
-                    cerr << " not in vocab\n";
-                }
-                ++pos;
-            }
+            tokenize_each(doc.content.data(), doc.content.size(), stopwords, word, [&](const string &tok)
+                          {
+                              cerr << "  token: [" << tok << "]";
+                              auto term = V.find(tok);
+                              if (term != V.end())
+                              {
+                                  const TermFrequency &frequency = term->second;
+                                  auto &postings = index[tok];
+                                  if (postings.empty())
+                                      postings.reserve(frequency.df);
+                                  vector<int> &positions = postings[doc.doc_id];
+                                  if (positions.empty() && frequency.df > 0)
+                                      positions.reserve(frequency.cf / frequency.df);
+                                  positions.push_back(pos);
+                                  cerr << " in vocab\n";
+                              }
+                              else
+                              {
+                                  cerr << " not in vocab\n";
+                              }
+                              ++pos;
+                          });
+        }
+        if (!corpus_file.close())
+        {
+            // Truncated or damaged: the statistics would cover partial input
+            cerr << "Error: Failed to decompress corpus file: " << corpus_file_path << endl;
+            global_corpus_failed = true;
+            return index;
         }
-        corpus_file.close();
     }
 
     return index;
@@ -231,7 +453,7 @@ void save_index(inverted_index index, string index_dir)
     out << "}\n";
 
     out.close();
-    cout << "Inverted index saved to " << out_path << endl;
+    status_stream() << "Inverted index saved to " << out_path << endl;
 }
 
 // Compression helper functions
@@ -396,16 +618,306 @@ void encode_vbyte_list(const vector<uint32_t> &values, vector<uint8_t> &output)
     }
 }
 
+// Append one posting list in the postings.bin layout:
+// [doc_count] then per document [doc_id][pos_count][delta-coded positions]
+void encode_posting_list(const vector<pair<uint32_t, uint32_t>> &doc_positions, vector<uint8_t> &output)
+{
+    vector<uint8_t> body;
+    uint32_t doc_count = 0;
+    for (size_t i = 0; i < doc_positions.size();)
+    {
+        size_t j = i;
+        while (j < doc_positions.size() && doc_positions[j].first == doc_positions[i].first)
+            j++;
+
+        encode_vbyte_list(vector<uint32_t>{doc_positions[i].first, (uint32_t)(j - i)}, body);
+        uint32_t previous = 0;
+        for (size_t k = i; k < j; k++)
+        {
+            encode_vbyte_list(vector<uint32_t>{doc_positions[k].second - previous}, body);
+            previous = doc_positions[k].second;
+        }
+        doc_count++;
+        i = j;
+    }
+
+    encode_vbyte_list(vector<uint32_t>{doc_count}, output);
+    output.insert(output.end(), body.begin(), body.end());
+}
+
+// Bi-word index: postings for selected adjacent term pairs ("a b"), stored
+// with the start position of each occurrence. Pairs are chosen by document
+// frequency (common pairs have long position lists on both sides) and/or
+// from the phrases of a query log; retrieval answers covered phrases from it.
+void compress_biword_index(const map<string, map<string, vector<uint32_t>>> &index,
+                           const map<string, uint32_t> &doc_to_id, const string &compressed_dir)
+{
+    // Forward view of every document: term id at each position (0 = none)
+    vector<string> terms;
+    vector<vector<uint32_t>> doc_terms(doc_to_id.size());
+    for (const auto &term_entry : index)
+    {
+        terms.push_back(term_entry.first);
+        for (const auto &doc_entry : term_entry.second)
+        {
+            vector<uint32_t> &slots = doc_terms[doc_to_id.at(doc_entry.first)];
+            for (uint32_t position : doc_entry.second)
+            {
+                if (position >= slots.size())
+                    slots.resize(position + 1, 0);
+                slots[position] = terms.size();
+            }
+        }
+    }
+
+    // Select pairs, keyed by (first term id << 32 | second term id)
+    unordered_set<uint64_t> selected;
+    if (global_build_options.biword_min_df > 0)
+    {
+        unordered_map<uint64_t, pair<uint32_t, uint32_t>> pair_df; // key -> (df, last doc + 1)
+        for (uint32_t doc_id = 0; doc_id < doc_terms.size(); doc_id++)
+        {
+            const vector<uint32_t> &slots = doc_terms[doc_id];
+            for (size_t p = 0; p + 1 < slots.size(); p++)
+            {
+                if (!slots[p] || !slots[p + 1])
+                    continue;
+                pair<uint32_t, uint32_t> &entry = pair_df[(uint64_t)slots[p] << 32 | slots[p + 1]];
+                if (entry.second != doc_id + 1)
+                {
+                    entry.first++;
+                    entry.second = doc_id + 1;
+                }
+            }
+        }
+        for (const auto &entry : pair_df)
+        {
+            if (entry.second.first >= global_build_options.biword_min_df)
+                selected.insert(entry.first);
+        }
+    }
+    for (const auto &logged : global_build_options.biword_log)
+    {
+        auto first = lower_bound(terms.begin(), terms.end(), logged.first);
+        auto second = lower_bound(terms.begin(), terms.end(), logged.second);
+        if (first != terms.end() && *first == logged.first && second != terms.end() && *second == logged.second)
+            selected.insert((uint64_t)(first - terms.begin() + 1) << 32 | (second - terms.begin() + 1));
+    }
+
+    // Collect (doc, start position) occurrences of the selected pairs
+    unordered_map<uint64_t, vector<pair<uint32_t, uint32_t>>> occurrences;
+    for (uint32_t doc_id = 0; doc_id < doc_terms.size(); doc_id++)
+    {
+        const vector<uint32_t> &slots = doc_terms[doc_id];
+        for (size_t p = 0; p + 1 < slots.size(); p++)
+        {
+            uint64_t key = (uint64_t)slots[p] << 32 | slots[p + 1];
+            if (slots[p] && slots[p + 1] && selected.count(key))
+                occurrences[key].push_back(make_pair(doc_id, (uint32_t)p));
+        }
+    }
+
+    map<string, uint64_t> biwords;
+    for (const auto &entry : occurrences)
+    {
+        biwords[terms[(entry.first >> 32) - 1] + " " + terms[(entry.first & 0xffffffffu) - 1]] = entry.first;
+    }
+
+    ofstream postings_file(compressed_dir + "/biword_postings.bin", ios::binary);
+    map<string, pair<size_t, size_t>> metadata;
+    size_t current_offset = 0;
+    for (const auto &biword : biwords)
+    {
+        vector<uint8_t> compressed_data;
+        encode_posting_list(occurrences[biword.second], compressed_data);
+        postings_file.write(reinterpret_cast<const char *>(compressed_data.data()), compressed_data.size());
+        metadata[biword.first] = make_pair(current_offset, compressed_data.size());
+        current_offset += compressed_data.size();
+    }
+    postings_file.close();
+    write_metadata_json(metadata, compressed_dir + "/biword_metadata.json");
+
+    status_stream() << "Bi-word index: " << biwords.size() << " pairs, " << current_offset << " bytes" << endl;
+}
+
+// BM25 statistics for ranked retrieval: document lengths (indexed tokens)
+// and per-term / per-block score upper bounds, written to bm25.bin
+void compress_ranking_index(const map<string, map<string, vector<uint32_t>>> &index,
+                            const map<string, uint32_t> &doc_to_id, const string &compressed_dir)
+{
+    RankingStats stats;
+    stats.doc_lengths.assign(doc_to_id.size(), 0);
+    for (const auto &term_entry : index)
+    {
+        for (const auto &doc_entry : term_entry.second)
+        {
+            stats.doc_lengths[doc_to_id.at(doc_entry.first)] += doc_entry.second.size();
+        }
+    }
+    finish_ranking_stats(stats);
+    bool sharded = global_collection_stats.doc_count > 0;
+    if (sharded)
+    {
+        stats.collection_size = global_collection_stats.doc_count;
+        stats.avg_doc_length = global_collection_stats.avg_doc_length();
+    }
+
+    // Terms and documents iterate in sorted order, i.e. metadata and doc ID order
+    vector<TermScoreBounds> bounds;
+    vector<pair<uint32_t, uint32_t>> postings;
+    for (const auto &term_entry : index)
+    {
+        postings.clear();
+        for (const auto &doc_entry : term_entry.second)
+        {
+            postings.push_back(make_pair(doc_to_id.at(doc_entry.first), (uint32_t)doc_entry.second.size()));
+        }
+        uint32_t df = sharded ? global_collection_stats.df.at(term_entry.first) : postings.size();
+        bounds.push_back(compute_score_bounds(postings, df, stats));
+    }
+
+    write_ranking_file(compressed_dir + "/bm25.bin", stats, bounds);
+}
+
+// Permuterm index for wildcard queries with a leading or inner *, written
+// to permuterm.bin (terms is the sorted dictionary)
+void compress_permuterm_index(const vector<string> &terms, const string &compressed_dir)
+{
+    vector<const string *> term_list;
+    for (const string &term : terms)
+    {
+        term_list.push_back(&term);
+    }
+    vector<PermutermEntry> entries = build_permuterm(term_list);
+    write_permuterm_file(compressed_dir + "/permuterm.bin", term_list.size(), entries);
+
+    status_stream() << "Permuterm index: " << entries.size() << " rotations" << endl;
+}
+
+// Stopword and operator table the index was built with, written to
+// analyzer.bin
+void compress_analyzer(const string &vocab_path, const string &compressed_dir)
+{
+    WordTable words = load_analyzer_words(vocab_path);
+    write_analyzer_file(compressed_dir + "/analyzer.bin", words);
+
+    status_stream() << "Analyzer: " << words.size() << " stopword and operator words (analyzer.bin)" << endl;
+}
+
+// Shard of a document, by a hash of its name: shards get similar numbers of
+// documents whatever order the corpus lists them in
+uint32_t document_shard(const string &doc_id, uint32_t shards)
+{
+    return word_hash(doc_id.data(), doc_id.size(), SHARD_HASH_SEED) % shards;
+}
+
+// Add the documents, tokens and per-term df of one shard's parsed index to
+// the collection statistics (shards hold disjoint documents)
+void add_collection_stats(const map<string, map<string, vector<uint32_t>>> &index, CollectionStats &stats)
+{
+    set<string> docs;
+    for (const auto &term_entry : index)
+    {
+        stats.df[term_entry.first] += term_entry.second.size();
+        for (const auto &doc_entry : term_entry.second)
+        {
+            docs.insert(doc_entry.first);
+            stats.token_count += doc_entry.second.size();
+        }
+    }
+    stats.doc_count += docs.size();
+}
+
+// Split an index by document into shards, moving the postings out of index
+vector<inverted_index> partition_index(inverted_index &index, uint32_t shards)
+{
+    vector<inverted_index> parts(shards);
+    for (auto &term_entry : index)
+    {
+        for (auto &doc_entry : term_entry.second)
+        {
+            parts[document_shard(doc_entry.first, shards)][term_entry.first][doc_entry.first] = move(doc_entry.second);
+        }
+    }
+    index.clear();
+    return parts;
+}
+
+// Document-partitioned build: each shard gets its own postings, dictionary
+// and doc map (plus bm25.bin, permuterm.bin and analyzer.bin) under
+// index_dir/shard_k and compressed_dir/shard_k, written by a thread pool
+void build_shards(inverted_index &index, const string &vocab_path, const string &index_dir,
+                  const string &compressed_dir)
+{
+    uint32_t shards = global_build_options.shards;
+    vector<inverted_index> parts = partition_index(index, shards);
+    for (uint32_t k = 0; k < shards; k++)
+    {
+        create_directory_if_not_exists(shard_directory(index_dir, k));
+        create_directory_if_not_exists(shard_directory(compressed_dir, k));
+    }
+
+    // Shards are written and parsed back first: BM25 statistics are summed
+    // over the parsed shards, the terms and documents compression sees
+    WorkStealingPool pool(min(resolve_thread_count(global_build_options.threads), shards));
+    vector<map<string, map<string, vector<uint32_t>>>> parsed(shards);
+    vector<CollectionStats> shard_stats(shards);
+    vector<ostringstream> logs(shards);
+    pool.start(shards, [&](size_t k)
+               {
+                   shard_log = &logs[k];
+                   string shard_index_dir = shard_directory(index_dir, k);
+                   save_index(move(parts[k]), shard_index_dir);
+                   load_index_json(shard_index_dir + "/index.json", parsed[k]);
+                   add_collection_stats(parsed[k], shard_stats[k]);
+                   shard_log = nullptr;
+               });
+    pool.wait();
+
+    global_collection_stats = CollectionStats();
+    for (const CollectionStats &stats : shard_stats)
+    {
+        global_collection_stats.doc_count += stats.doc_count;
+        global_collection_stats.token_count += stats.token_count;
+        for (const auto &df : stats.df)
+        {
+            global_collection_stats.df[df.first] += df.second;
+        }
+    }
+    shard_stats.clear();
+
+    pool.start(shards, [&](size_t k)
+               {
+                   shard_log = &logs[k];
+                   string shard_compressed_dir = shard_directory(compressed_dir, k);
+                   compress_parsed_index(parsed[k], shard_directory(index_dir, k) + "/index.json", shard_compressed_dir);
+                   parsed[k].clear();
+                   compress_analyzer(vocab_path, shard_compressed_dir);
+                   shard_log = nullptr;
+               });
+    pool.wait();
+
+    for (uint32_t k = 0; k < shards; k++)
+    {
+        cout << "Shard " << k << ":\n" << logs[k].str();
+    }
+
+    write_shard_manifest(compressed_dir, shards);
+    cout << "Sharded index: " << shards << " shards on " << pool.size() << " threads ("
+         << compressed_dir << "/" << SHARD_MANIFEST << ")" << endl;
+}
+
 // Function implementations for compression
 
-void compress_index(string path_to_index_file, string path_to_compressed_files_directory)
+// Load and parse an index.json written by save_index; false if it cannot
+// be opened
+bool load_index_json(const string &path, map<string, map<string, vector<uint32_t>>> &index)
 {
-    // Load and parse the original index.json manually
-    ifstream index_file(path_to_index_file);
+    ifstream index_file(path);
     if (!index_file.is_open())
     {
-        cerr << "Error: Cannot open index file: " << path_to_index_file << endl;
-        return;
+        cerr << "Error: Cannot open index file: " << path << endl;
+        return false;
     }
 
     // Read entire file content
@@ -413,9 +925,23 @@ void compress_index(string path_to_index_file, string path_to_compressed_files_d
     index_file.close();
 
     // Parse JSON manually
-    auto index = parse_json_index(json_content);
+    index = parse_json_index(json_content);
+    return true;
+}
+
+void compress_index(string path_to_index_file, string path_to_compressed_files_directory)
+{
+    // Load and parse the original index.json manually
+    map<string, map<string, vector<uint32_t>>> index;
+    if (load_index_json(path_to_index_file, index))
+        compress_parsed_index(index, path_to_index_file, path_to_compressed_files_directory);
+}
 
-    cout << "Loaded index with " << index.size() << " terms." << endl;
+// Compress an index parsed from path_to_index_file (which sizes the report)
+void compress_parsed_index(const map<string, map<string, vector<uint32_t>>> &index,
+                           const string &path_to_index_file, const string &path_to_compressed_files_directory)
+{
+    status_stream() << "Loaded index with " << index.size() << " terms." << endl;
 
     // Step 1: Create DocID mapping (string -> integer)
     map<string, uint32_t> doc_to_id;
@@ -439,7 +965,7 @@ void compress_index(string path_to_index_file, string path_to_compressed_files_d
         id_to_doc.push_back(doc);
     }
 
-    cout << "Created DocID mapping for " << doc_counter << " documents." << endl;
+    status_stream() << "Created DocID mapping for " << doc_counter << " documents." << endl;
 
     // Save DocID mapping using manual JSON writing
     write_doc_map_json(id_to_doc, path_to_compressed_files_directory + "/doc_map.json");
@@ -514,8 +1040,9 @@ void compress_index(string path_to_index_file, string path_to_compressed_files_d
 
         current_offset += compressed_data.size();
 
-        // Print compression info for all terms
-        cout << "Compressed term '" << term << "': " << compressed_data.size() << " bytes" << endl;
+        // Print compression info for all terms (not per shard: too much to buffer)
+        if (!shard_log)
+            cout << "Compressed term '" << term << "': " << compressed_data.size() << " bytes" << endl;
     }
 
     postings_file.close();
@@ -523,11 +1050,31 @@ void compress_index(string path_to_index_file, string path_to_compressed_files_d
     // Save metadata using manual JSON writing
     write_metadata_json(metadata, path_to_compressed_files_directory + "/metadata.json");
 
-    cout << "Compression complete!" << endl;
-    cout << "Files created:" << endl;
-    cout << "  - doc_map.json (DocID mapping)" << endl;
-    cout << "  - postings.bin (compressed postings)" << endl;
-    cout << "  - metadata.json (term metadata)" << endl;
+    // Document lengths and score bounds for ranked retrieval
+    compress_ranking_index(index, doc_to_id, path_to_compressed_files_directory);
+
+    // Rotations of every term for suffix and infix wildcards
+    compress_permuterm_index(terms, path_to_compressed_files_directory);
+
+    // Optional bi-word index for frequent or logged phrases
+    if (global_build_options.biword_min_df > 0 || !global_build_options.biword_log.empty())
+    {
+        compress_biword_index(index, doc_to_id, path_to_compressed_files_directory);
+    }
+    else
+    {
+        // Drop a bi-word index left by an earlier build; its doc IDs would be stale
+        remove((path_to_compressed_files_directory + "/biword_postings.bin").c_str());
+        remove((path_to_compressed_files_directory + "/biword_metadata.json").c_str());
+    }
+
+    status_stream() << "Compression complete!" << endl;
+    status_stream() << "Files created:" << endl;
+    status_stream() << "  - doc_map.json (DocID mapping)" << endl;
+    status_stream() << "  - postings.bin (compressed postings)" << endl;
+    status_stream() << "  - metadata.json (term metadata)" << endl;
+    status_stream() << "  - bm25.bin (document lengths and score bounds)" << endl;
+    status_stream() << "  - permuterm.bin (wildcard term rotations)" << endl;
 
     // Print compression statistics
     size_t original_size = get_file_size(path_to_index_file);
@@ -535,9 +1082,9 @@ void compress_index(string path_to_index_file, string path_to_compressed_files_d
                              get_file_size(path_to_compressed_files_directory + "/doc_map.json") +
                              get_file_size(path_to_compressed_files_directory + "/metadata.json");
 
-    cout << "Original size: " << original_size << " bytes" << endl;
-    cout << "Compressed size: " << compressed_size << " bytes" << endl;
-    cout << "Compression ratio: " << (double)original_size / compressed_size << "x" << endl;
+    status_stream() << "Original size: " << original_size << " bytes" << endl;
+    status_stream() << "Compressed size: " << compressed_size << " bytes" << endl;
+    status_stream() << "Compression ratio: " << (double)original_size / compressed_size << "x" << endl;
 }
 
 void save_compressed_index(inverted_index index, string compressed_dir)
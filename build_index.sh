@@ -1,11 +1,16 @@
 #!/bin/bash
 
 # build_index.sh - Shell script for Task 2 & 3: Inverted Index and Index Compression
-# Usage: ./build_index.sh <CORPUS_DIR> <VOCAB_PATH> <INDEX_DIR> <COMPRESSED_DIR>
+# Usage: ./build_index.sh <CORPUS_DIR> <VOCAB_PATH> <INDEX_DIR> <COMPRESSED_DIR> [OPTIONS...]
+# Options:
+#   --biword-min-df=N              Index adjacent term pairs found in at least N documents
+#   --biword-queries=QUERY_FILE    Index adjacent term pairs of quoted phrases in QUERY_FILE
+#   --shards=N                     Partition documents into N shards, each a complete index
+#   --threads=N                    Threads building shards (0 = one per core, the default)
 
 # Check if correct number of arguments provided
-if [ $# -ne 4 ]; then
-    echo "Usage: $0 <CORPUS_DIR> <VOCAB_PATH> <INDEX_DIR> <COMPRESSED_DIR>"
+if [ $# -lt 4 ]; then
+    echo "Usage: $0 <CORPUS_DIR> <VOCAB_PATH> <INDEX_DIR> <COMPRESSED_DIR> [--biword-min-df=N] [--biword-queries=QUERY_FILE] [--shards=N [--threads=N]]"
     echo "Example: $0 /path/to/corpus /path/to/vocab.txt /path/to/index_dir /path/to/compressed_dir"
     exit 1
 fi
@@ -15,7 +20,7 @@ SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
 
 # Compile the C++ program
 echo "Compiling build_index.cpp..."
-g++ -std=c++11 -o "${SCRIPT_DIR}/build_index" "${SCRIPT_DIR}/build_index.cpp"
+g++ -std=c++11 -pthread -o "${SCRIPT_DIR}/build_index" "${SCRIPT_DIR}/build_index.cpp"
 
 # Check if compilation was successful
 if [ $? -ne 0 ]; then
@@ -33,7 +38,7 @@ echo "  Index Directory: $3"
 echo "  Compressed Directory: $4"
 echo ""
 
-"${SCRIPT_DIR}/build_index" "$1" "$2" "$3" "$4"
+"${SCRIPT_DIR}/build_index" "$1" "$2" "$3" "$4" "${@:5}"
 
 # Check if execution was successful
 if [ $? -eq 0 ]; then
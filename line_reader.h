@@ -0,0 +1,328 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+#include "utf8.h"
+using namespace std;
+
+#ifndef _WIN32
+extern char **environ;
+#endif
+
+// Bytes read from the file per refill
+const size_t LINE_READER_CHUNK = 1 << 16;
+
+// Encodings recognized at the start of a text file
+enum TextEncoding
+{
+    ENCODING_UTF8,    // Also plain ASCII; an optional UTF-8 BOM is skipped
+    ENCODING_UTF16LE, // BOM FF FE, or '{' 00 at the start
+    ENCODING_UTF16BE  // BOM FE FF, or 00 '{' at the start
+};
+
+// Compressed formats, read through an external decompressor
+enum Compression
+{
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP, // Magic 1F 8B
+    COMPRESSION_ZSTD  // Magic 28 B5 2F FD
+};
+
+// Compression of a file, recognized by its magic bytes (not its extension)
+inline Compression detect_compression(const string &path)
+{
+    unsigned char magic[4] = {0, 0, 0, 0};
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return COMPRESSION_NONE;
+    size_t n = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    if (n >= 2 && magic[0] == 0x1F && magic[1] == 0x8B)
+        return COMPRESSION_GZIP;
+    if (n == 4 && magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD)
+        return COMPRESSION_ZSTD;
+    return COMPRESSION_NONE;
+}
+
+// A running decompressor: the read end of its output pipe and its process
+struct Decompressor
+{
+    FILE *output;
+    long pid; // Unused on Windows (_pclose waits for the process)
+
+    Decompressor() : output(nullptr), pid(-1) {}
+};
+
+// Start gzip -dc / zstd -dcq on a compressed file, its output read through
+// a pipe. The path is passed as an argument of its own (after "--"), never
+// through a shell, so file names cannot inject commands.
+inline bool open_decompressor(const string &path, Compression compression, Decompressor &process)
+{
+    const char *tool = compression == COMPRESSION_GZIP ? "gzip" : "zstd";
+#ifdef _WIN32
+    // _popen always goes through cmd.exe: refuse names it would expand
+    if (path.find_first_of("\"%^&|<>") != string::npos)
+        return false;
+    string command = string(tool) + (compression == COMPRESSION_GZIP ? " -dc -- \"" : " -dcq -- \"") + path + "\"";
+    process.output = _popen(command.c_str(), "rb");
+    return process.output != nullptr;
+#else
+    const char *flags = compression == COMPRESSION_GZIP ? "-dc" : "-dcq";
+    char *argv[] = {const_cast<char *>(tool), const_cast<char *>(flags), const_cast<char *>("--"),
+                    const_cast<char *>(path.c_str()), nullptr};
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    // Neither end leaks into later children; dup2 gives the child a plain stdout
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    pid_t pid;
+    int error = posix_spawnp(&pid, tool, &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    ::close(fds[1]);
+    if (error != 0)
+    {
+        ::close(fds[0]);
+        return false;
+    }
+    process.pid = pid;
+    process.output = fdopen(fds[0], "rb");
+    if (!process.output)
+    {
+        ::close(fds[0]);
+        waitpid(pid, nullptr, 0);
+        return false;
+    }
+    return true;
+#endif
+}
+
+// Close a decompressor's output and wait for it; false if it failed
+// (damaged or truncated input, tool killed)
+inline bool close_decompressor(Decompressor &process)
+{
+#ifdef _WIN32
+    bool ok = _pclose(process.output) == 0;
+#else
+    fclose(process.output);
+    int status = 0;
+    bool ok = waitpid((pid_t)process.pid, &status, 0) == (pid_t)process.pid && WIFEXITED(status) &&
+              WEXITSTATUS(status) == 0;
+#endif
+    process = Decompressor();
+    return ok;
+}
+
+// Streaming line reader: detects the file's encoding from its first bytes
+// and yields its lines as UTF-8 (UTF-16 transcoded, surrogate pairs joined,
+// unpaired surrogates replaced by U+FFFD), reading fixed-size chunks so
+// memory stays constant however long the file is. Lines come without their
+// "\n" or "\r\n"; in UTF-16 a NUL code unit ends the text. Gzip and zstd
+// files are decompressed on the fly by gzip / zstd in a child process, which
+// runs concurrently with the reader and hands it the text through a pipe.
+class LineReader
+{
+public:
+    LineReader()
+        : file_(nullptr), owns_file_(false), is_pipe_(false), compression_(COMPRESSION_NONE),
+          encoding_(ENCODING_UTF8), pos_(0), end_(0), finished_(false) {}
+
+    ~LineReader() { close(); }
+
+    // Open path ("-" = standard input), decompressing it if it is a gzip or
+    // zstd file, and detect its encoding
+    bool open(const string &path)
+    {
+        close();
+        compression_ = path == "-" ? COMPRESSION_NONE : detect_compression(path);
+        if (path == "-")
+        {
+            file_ = stdin;
+        }
+        else if (compression_ != COMPRESSION_NONE)
+        {
+            if (open_decompressor(path, compression_, decompressor_))
+                file_ = decompressor_.output;
+            owns_file_ = is_pipe_ = file_ != nullptr;
+        }
+        else
+        {
+            file_ = fopen(path.c_str(), "rb");
+            owns_file_ = true;
+        }
+        if (!file_)
+            return false;
+
+        buffer_.resize(LINE_READER_CHUNK);
+        pos_ = end_ = 0;
+        finished_ = false;
+        encoding_ = ENCODING_UTF8;
+        fill(4);
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(buffer_.data());
+        size_t n = end_ - pos_;
+        if (n >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF)
+        {
+            pos_ += 3;
+        }
+        else if (n >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE)
+        {
+            encoding_ = ENCODING_UTF16LE;
+            pos_ += 2;
+        }
+        else if (n >= 2 && bytes[0] == 0xFE && bytes[1] == 0xFF)
+        {
+            encoding_ = ENCODING_UTF16BE;
+            pos_ += 2;
+        }
+        else if (n >= 2 && bytes[0] == '{' && bytes[1] == 0)
+        {
+            encoding_ = ENCODING_UTF16LE;
+        }
+        else if (n >= 2 && bytes[0] == 0 && bytes[1] == '{')
+        {
+            encoding_ = ENCODING_UTF16BE;
+        }
+        return true;
+    }
+
+    TextEncoding encoding() const { return encoding_; }
+
+    // Read the next line into line; false once the input is exhausted
+    bool next_line(string &line)
+    {
+        line.clear();
+        bool found = encoding_ == ENCODING_UTF8 ? next_utf8(line) : next_utf16(line);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        return found;
+    }
+
+    // Compression detected by the last open (also when the decompressor
+    // could not be started)
+    Compression compression() const { return compression_; }
+
+    // Close the input; false if its decompressor failed
+    bool close()
+    {
+        bool ok = true;
+        if (owns_file_ && file_)
+        {
+            if (is_pipe_)
+                ok = close_decompressor(decompressor_);
+            else
+                fclose(file_);
+        }
+        file_ = nullptr;
+        owns_file_ = is_pipe_ = false;
+        return ok;
+    }
+
+private:
+    // Ensure at least want unread bytes (fewer only at end of file)
+    bool fill(size_t want)
+    {
+        while (end_ - pos_ < want && file_ && !feof(file_))
+        {
+            if (pos_ > 0)
+            {
+                memmove(&buffer_[0], &buffer_[pos_], end_ - pos_);
+                end_ -= pos_;
+                pos_ = 0;
+            }
+            size_t got = fread(&buffer_[end_], 1, buffer_.size() - end_, file_);
+            end_ += got;
+            if (got == 0)
+                break;
+        }
+        return end_ - pos_ >= want;
+    }
+
+    bool next_utf8(string &line)
+    {
+        bool any = false;
+        while (pos_ < end_ || fill(1))
+        {
+            any = true;
+            const char *start = &buffer_[pos_];
+            const char *newline = static_cast<const char *>(memchr(start, '\n', end_ - pos_));
+            if (newline)
+            {
+                line.append(start, newline - start);
+                pos_ += newline - start + 1;
+                return true;
+            }
+            line.append(start, end_ - pos_);
+            pos_ = end_;
+        }
+        return any;
+    }
+
+    // Next UTF-16 code unit; false at end of input (or at a NUL)
+    bool next_unit(uint32_t &unit)
+    {
+        if (finished_ || !fill(2))
+            return false;
+        unsigned char a = buffer_[pos_], b = buffer_[pos_ + 1];
+        pos_ += 2;
+        unit = encoding_ == ENCODING_UTF16LE ? (uint32_t)(a | b << 8) : (uint32_t)(a << 8 | b);
+        if (unit == 0)
+            finished_ = true;
+        return unit != 0;
+    }
+
+    bool next_utf16(string &line)
+    {
+        bool any = false;
+        uint32_t unit;
+        while (next_unit(unit))
+        {
+            any = true;
+            if (unit == '\n')
+                return true;
+            if (unit >= 0xD800 && unit < 0xDC00)
+            {
+                // High surrogate: join with the following low surrogate
+                if (fill(2))
+                {
+                    unsigned char a = buffer_[pos_], b = buffer_[pos_ + 1];
+                    uint32_t low = encoding_ == ENCODING_UTF16LE ? (uint32_t)(a | b << 8) : (uint32_t)(a << 8 | b);
+                    if (low >= 0xDC00 && low < 0xE000)
+                    {
+                        pos_ += 2;
+                        append_utf8(0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00), line);
+                        continue;
+                    }
+                }
+                unit = 0xFFFD;
+            }
+            else if (unit >= 0xDC00 && unit < 0xE000)
+            {
+                unit = 0xFFFD;
+            }
+            append_utf8(unit, line);
+        }
+        return any;
+    }
+
+    FILE *file_;
+    bool owns_file_;
+    bool is_pipe_; // file_ is a decompressor's output
+    Decompressor decompressor_;
+    Compression compression_;
+    TextEncoding encoding_;
+    vector<char> buffer_;
+    size_t pos_, end_;
+    bool finished_; // A UTF-16 NUL ended the text
+};
@@ -0,0 +1,209 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+using namespace std;
+
+// Largest thread count accepted from the command line
+const unsigned MAX_POOL_THREADS = 1024;
+
+// Resolve a user-supplied thread count (0 = one per hardware thread)
+inline unsigned resolve_thread_count(unsigned requested)
+{
+    if (requested > 0)
+        return requested;
+    unsigned hardware = thread::hardware_concurrency();
+    return hardware > 0 ? hardware : 1;
+}
+
+// Work-stealing thread pool. A job over items [0, n) is split into
+// contiguous ranges, one deque per worker; a worker pops from the front of
+// its own deque and, once that is empty, steals from the back of another.
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(unsigned threads)
+        : generation_(0), busy_(0), remaining_(0), stopping_(false)
+    {
+        for (unsigned w = 0; w < threads; w++)
+        {
+            queues_.push_back(unique_ptr<WorkQueue>(new WorkQueue()));
+        }
+        for (unsigned w = 0; w < threads; w++)
+        {
+            threads_.push_back(thread(&WorkStealingPool::worker_loop, this, w));
+        }
+    }
+
+    ~WorkStealingPool()
+    {
+        {
+            lock_guard<mutex> guard(lock_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto &t : threads_)
+        {
+            t.join();
+        }
+    }
+
+    unsigned size() const { return threads_.size(); }
+
+    // Start task(i) for every i in [0, n) without waiting for completion
+    void start(size_t n, function<void(size_t)> task)
+    {
+        if (n == 0)
+            return;
+
+        size_t workers = queues_.size();
+        size_t chunk = (n + workers - 1) / workers;
+        for (size_t w = 0; w < workers; w++)
+        {
+            lock_guard<mutex> guard(queues_[w]->lock);
+            for (size_t i = w * chunk; i < n && i < (w + 1) * chunk; i++)
+            {
+                queues_[w]->items.push_back(i);
+            }
+        }
+
+        {
+            lock_guard<mutex> guard(lock_);
+            task_ = task;
+            remaining_ = n;
+            generation_++;
+        }
+        wake_.notify_all();
+    }
+
+    // Block until every task of the current job has finished and every
+    // worker has left the job (so the next start() cannot hand one of its
+    // items to a worker still holding this job's task)
+    void wait()
+    {
+        unique_lock<mutex> guard(lock_);
+        done_.wait(guard, [this]
+                   { return remaining_ == 0 && busy_ == 0; });
+    }
+
+private:
+    struct WorkQueue
+    {
+        mutex lock;
+        deque<size_t> items;
+    };
+
+    bool pop_local(unsigned w, size_t &item)
+    {
+        lock_guard<mutex> guard(queues_[w]->lock);
+        if (queues_[w]->items.empty())
+            return false;
+        item = queues_[w]->items.front();
+        queues_[w]->items.pop_front();
+        return true;
+    }
+
+    bool steal(unsigned w, size_t &item)
+    {
+        for (size_t k = 1; k < queues_.size(); k++)
+        {
+            WorkQueue &victim = *queues_[(w + k) % queues_.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.items.empty())
+            {
+                item = victim.items.back();
+                victim.items.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker_loop(unsigned w)
+    {
+        size_t seen = 0;
+        while (true)
+        {
+            function<void(size_t)> task;
+            {
+                unique_lock<mutex> guard(lock_);
+                wake_.wait(guard, [this, seen]
+                           { return stopping_ || generation_ != seen; });
+                if (stopping_)
+                    return;
+                seen = generation_;
+                task = task_;
+                busy_++;
+            }
+
+            size_t item;
+            while (pop_local(w, item) || steal(w, item))
+            {
+                task(item);
+                if (remaining_.fetch_sub(1) == 1)
+                {
+                    lock_guard<mutex> guard(lock_);
+                    done_.notify_all();
+                }
+            }
+
+            lock_guard<mutex> guard(lock_);
+            if (--busy_ == 0)
+                done_.notify_all();
+        }
+    }
+
+    vector<unique_ptr<WorkQueue>> queues_;
+    vector<thread> threads_;
+    mutex lock_;
+    condition_variable wake_, done_;
+    function<void(size_t)> task_;
+    size_t generation_;
+    unsigned busy_; // Workers inside a job's item loop
+    atomic<size_t> remaining_;
+    bool stopping_;
+};
+
+// Reorder buffer: results may be put in any order but are taken in order
+template <typename T>
+class ReorderBuffer
+{
+public:
+    void reset(size_t n)
+    {
+        lock_guard<mutex> guard(lock_);
+        slots_.assign(n, T());
+        ready_.assign(n, 0);
+    }
+
+    void put(size_t i, T value)
+    {
+        {
+            lock_guard<mutex> guard(lock_);
+            slots_[i] = move(value);
+            ready_[i] = 1;
+        }
+        ready_cv_.notify_all();
+    }
+
+    // Block until slot i is filled, then hand over its value
+    T take(size_t i)
+    {
+        unique_lock<mutex> guard(lock_);
+        ready_cv_.wait(guard, [this, i]
+                       { return ready_[i] != 0; });
+        T value = move(slots_[i]);
+        return value;
+    }
+
+private:
+    mutex lock_;
+    condition_variable ready_cv_;
+    vector<T> slots_;
+    vector<char> ready_;
+};
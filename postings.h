@@ -0,0 +1,855 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <climits>
+#include <algorithm>
+#include <iterator>
+#include "simd.h"
+using namespace std;
+
+// Sorted list of integer document IDs
+typedef vector<uint32_t> DocList;
+
+// Size ratio above which an intersection gallops through the longer list
+const size_t GALLOP_RATIO = 32;
+
+// Shortest list worth handing to the SIMD block-compare kernels
+const size_t SIMD_MIN_LENGTH = 16;
+
+// Number of postings between two skip entries of a compressed posting list
+const uint32_t SKIP_INTERVAL = 64;
+
+// Unions whose inputs cover at least 1/UNION_BITMAP_RATIO of the collection
+// are accumulated in a bitmap instead of heap-merged
+const size_t UNION_BITMAP_RATIO = 32;
+
+// Half-open range of doc IDs [begin, end) that an evaluation is restricted to
+struct DocRange
+{
+    uint32_t begin;
+    uint32_t end;
+
+    DocRange() : begin(0), end(UINT32_MAX) {}
+    DocRange(uint32_t b, uint32_t e) : begin(b), end(e) {}
+};
+
+// Variable-byte decoding from a raw buffer (stops at end)
+inline uint32_t read_vbyte(const uint8_t *data, size_t &pos, size_t end)
+{
+    uint32_t result = 0;
+    uint32_t shift = 0;
+
+    while (pos < end)
+    {
+        uint8_t byte = data[pos++];
+        result |= (uint32_t)(byte & 127) << shift;
+        if ((byte & 128) == 0)
+            break; // Final byte has MSB=0
+        shift += 7;
+    }
+    return result;
+}
+
+// Skip over count variable-byte values without decoding them
+inline void skip_vbytes(const uint8_t *data, size_t &pos, size_t end, uint32_t count)
+{
+    while (count > 0 && pos < end)
+    {
+        if ((data[pos++] & 128) == 0)
+            count--;
+    }
+}
+
+// Variable-byte encoding onto the end of a buffer
+inline void append_vbyte(uint32_t value, vector<uint8_t> &output)
+{
+    while (value >= 128)
+    {
+        output.push_back((value & 127) | 128);
+        value >>= 7;
+    }
+    output.push_back(value & 127);
+}
+
+// ---------------------------------------------------------------------------
+// Intersection kernels on decoded lists (results are appended to out)
+// ---------------------------------------------------------------------------
+
+// Linear merge, best for short lists of similar size
+inline void intersect_merge(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, DocList &out)
+{
+    size_t i = 0, j = 0;
+    while (i < na && j < nb)
+    {
+        if (a[i] < b[j])
+            i++;
+        else if (b[j] < a[i])
+            j++;
+        else
+        {
+            out.push_back(a[i]);
+            i++;
+            j++;
+        }
+    }
+}
+
+// Exponential search: first index >= lo whose value is >= target
+inline size_t gallop_to(const uint32_t *list, size_t lo, size_t n, uint32_t target)
+{
+    if (lo >= n || list[lo] >= target)
+        return lo;
+
+    // Invariant: list[lo] < target
+    size_t step = 1;
+    size_t hi = lo + 1;
+    while (hi < n && list[hi] < target)
+    {
+        lo = hi;
+        step <<= 1;
+        hi = lo + step;
+    }
+    size_t end = hi < n ? hi + 1 : n;
+    return lower_bound(list + lo + 1, list + end, target) - list;
+}
+
+// Galloping intersection, best when one list is much shorter than the other
+inline void intersect_gallop(const uint32_t *small, size_t ns, const uint32_t *large, size_t nl, DocList &out)
+{
+    size_t j = 0;
+    for (size_t i = 0; i < ns; i++)
+    {
+        j = gallop_to(large, j, nl, small[i]);
+        if (j >= nl)
+            break;
+        if (large[j] == small[i])
+        {
+            out.push_back(small[i]);
+            j++;
+        }
+    }
+}
+
+#if defined(HAVE_X86_SIMD) && defined(__SSE2__)
+// SSE2 block compare: each 4-wide block of a is compared against all four
+// rotations of the current block of b, and the block with the smaller
+// maximum advances
+inline void intersect_sse2(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, DocList &out)
+{
+    size_t i = 0, j = 0;
+    while (i + 4 <= na && j + 4 <= nb)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + j));
+        __m128i m01 = _mm_or_si128(_mm_cmpeq_epi32(va, vb),
+                                   _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1))));
+        __m128i m23 = _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                                   _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3))));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(m01, m23)));
+        while (mask)
+        {
+            out.push_back(a[i + __builtin_ctz(mask)]);
+            mask &= mask - 1;
+        }
+
+        uint32_t a_max = a[i + 3], b_max = b[j + 3];
+        if (a_max <= b_max)
+            i += 4;
+        if (b_max <= a_max)
+            j += 4;
+    }
+    intersect_merge(a + i, na - i, b + j, nb - j, out);
+}
+#endif
+
+#ifdef HAVE_X86_SIMD
+// AVX2 block compare: 8x8 all-pairs comparison using lane rotations
+SIMD_TARGET("avx2")
+inline void intersect_avx2(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, DocList &out)
+{
+    const __m256i rotate = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+    size_t i = 0, j = 0;
+    while (i + 8 <= na && j + 8 <= nb)
+    {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + j));
+        __m256i matches = _mm256_cmpeq_epi32(va, vb);
+        for (int r = 1; r < 8; r++)
+        {
+            vb = _mm256_permutevar8x32_epi32(vb, rotate);
+            matches = _mm256_or_si256(matches, _mm256_cmpeq_epi32(va, vb));
+        }
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(matches));
+        while (mask)
+        {
+            out.push_back(a[i + __builtin_ctz(mask)]);
+            mask &= mask - 1;
+        }
+
+        uint32_t a_max = a[i + 7], b_max = b[j + 7];
+        if (a_max <= b_max)
+            i += 8;
+        if (b_max <= a_max)
+            j += 8;
+    }
+    intersect_merge(a + i, na - i, b + j, nb - j, out);
+}
+#endif
+
+// Adaptive pairwise intersection: galloping for skewed sizes, SIMD block
+// compare for similar sizes, plain merge otherwise
+inline void intersect_lists(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, DocList &out)
+{
+    if (na > nb)
+    {
+        swap(a, b);
+        swap(na, nb);
+    }
+    if (na == 0)
+        return;
+
+    if (nb / na >= GALLOP_RATIO)
+    {
+        intersect_gallop(a, na, b, nb, out);
+        return;
+    }
+
+#ifdef HAVE_X86_SIMD
+    if (na >= SIMD_MIN_LENGTH)
+    {
+        if (cpu_has_avx2())
+        {
+            intersect_avx2(a, na, b, nb, out);
+            return;
+        }
+#ifdef __SSE2__
+        intersect_sse2(a, na, b, nb, out);
+        return;
+#endif
+    }
+#endif
+
+    intersect_merge(a, na, b, nb, out);
+}
+
+// Set difference a - b, galloping through whichever list is much longer
+inline void difference_lists(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, DocList &out)
+{
+    if (na == 0)
+        return;
+
+    if (nb / na >= GALLOP_RATIO)
+    {
+        // Few candidates: look each one up in b
+        size_t j = 0;
+        for (size_t i = 0; i < na; i++)
+        {
+            j = gallop_to(b, j, nb, a[i]);
+            if (j >= nb || b[j] != a[i])
+                out.push_back(a[i]);
+        }
+    }
+    else if (nb == 0 || na / nb >= GALLOP_RATIO)
+    {
+        // Few exclusions: copy the runs of a between them
+        size_t i = 0;
+        for (size_t j = 0; j < nb; j++)
+        {
+            size_t k = gallop_to(a, i, na, b[j]);
+            out.insert(out.end(), a + i, a + k);
+            i = k;
+            if (i < na && a[i] == b[j])
+                i++;
+        }
+        out.insert(out.end(), a + i, a + na);
+    }
+    else
+    {
+        set_difference(a, a + na, b, b + nb, back_inserter(out));
+    }
+}
+
+// Pairwise union of two decoded lists
+inline void union_lists(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, DocList &out)
+{
+    set_union(a, a + na, b, b + nb, back_inserter(out));
+}
+
+// ---------------------------------------------------------------------------
+// Compressed posting lists (postings.bin) with skip-aware cursors
+//
+// Layout per term: [doc_count] then per document [doc_id][pos_count][positions
+// as deltas], all variable-byte encoded. Skip tables are built once at load
+// time so cursors can jump over whole blocks without touching their bytes.
+// ---------------------------------------------------------------------------
+
+// Skip entry: first posting of a block of SKIP_INTERVAL postings
+struct SkipEntry
+{
+    uint32_t doc_id; // Doc ID of the block's first posting
+    uint32_t index;  // Posting number of the block's first posting
+    size_t offset;   // Byte offset of the block's first posting
+};
+
+// Location, document frequency and skip table of one term's posting list
+struct TermPostings
+{
+    size_t offset;
+    size_t length;
+    uint32_t doc_count;
+    vector<SkipEntry> skips;
+
+    TermPostings() : offset(0), length(0), doc_count(0) {}
+};
+
+// Term dictionary over a postings.bin buffer, shared read-only by all queries
+struct CompressedPostings
+{
+    vector<uint8_t> data;
+    map<string, TermPostings> terms;
+};
+
+// Scan a posting list once to record its document frequency and skip table
+inline void build_skip_table(const vector<uint8_t> &data, TermPostings &term)
+{
+    size_t pos = term.offset;
+    size_t end = min(term.offset + term.length, data.size());
+    term.doc_count = read_vbyte(data.data(), pos, end);
+    term.skips.clear();
+
+    if (term.doc_count <= SKIP_INTERVAL)
+        return;
+
+    for (uint32_t i = 0; i < term.doc_count && pos < end; i++)
+    {
+        size_t start = pos;
+        uint32_t doc_id = read_vbyte(data.data(), pos, end);
+        uint32_t pos_count = read_vbyte(data.data(), pos, end);
+        skip_vbytes(data.data(), pos, end, pos_count);
+
+        if (i > 0 && i % SKIP_INTERVAL == 0)
+        {
+            SkipEntry skip;
+            skip.doc_id = doc_id;
+            skip.index = i;
+            skip.offset = start;
+            term.skips.push_back(skip);
+        }
+    }
+}
+
+// Attach postings.bin bytes and metadata (term -> offset, length)
+inline void load_compressed_postings(CompressedPostings &postings,
+                                     vector<uint8_t> data,
+                                     const map<string, pair<size_t, size_t>> &metadata)
+{
+    postings.data.swap(data);
+    postings.terms.clear();
+
+    for (const auto &term_meta : metadata)
+    {
+        if (term_meta.second.first >= postings.data.size())
+            continue; // Invalid offset
+
+        TermPostings &term = postings.terms[term_meta.first];
+        term.offset = term_meta.second.first;
+        term.length = term_meta.second.second;
+        build_skip_table(postings.data, term);
+    }
+}
+
+// Dictionary lookup (nullptr if the term is not indexed)
+inline const TermPostings *find_term(const CompressedPostings &postings, const string &term)
+{
+    auto it = postings.terms.find(term);
+    return it == postings.terms.end() ? nullptr : &it->second;
+}
+
+// Compressed posting bytes scanned by cursors on this thread (profiling)
+inline size_t &scanned_bytes_counter()
+{
+    static thread_local size_t bytes = 0;
+    return bytes;
+}
+
+// Forward-only cursor over one compressed posting list
+struct PostingCursor
+{
+    const uint8_t *data;
+    const TermPostings *term;
+    size_t end;
+    size_t pos;      // Byte offset of the current document's positions
+    size_t skipped;  // Bytes jumped over through skip entries
+    uint32_t index;  // Posting number of the current document
+    uint32_t doc_id; // Current document
+    uint32_t tf;     // Number of positions of the current document
+
+    PostingCursor(const CompressedPostings &postings, const TermPostings &t)
+        : data(postings.data.data()), term(&t), end(t.offset + t.length), pos(t.offset), skipped(0), index(0),
+          doc_id(0), tf(0)
+    {
+        read_vbyte(data, pos, end); // Document count (already in the dictionary)
+        load();
+    }
+
+    bool at_end() const { return index >= term->doc_count; }
+
+    // Move to the next document, skipping the current one's positions
+    void next()
+    {
+        skip_vbytes(data, pos, end, tf);
+        index++;
+        load();
+    }
+
+    // Move to the first document >= target, jumping whole blocks via skips
+    void advance(uint32_t target)
+    {
+        if (at_end() || doc_id >= target)
+            return;
+
+        const vector<SkipEntry> &skips = term->skips;
+        if (!skips.empty() && skips[0].doc_id <= target)
+        {
+            size_t lo = 0, hi = skips.size();
+            while (hi - lo > 1)
+            {
+                size_t mid = (lo + hi) / 2;
+                if (skips[mid].doc_id <= target)
+                    lo = mid;
+                else
+                    hi = mid;
+            }
+            if (skips[lo].index > index)
+            {
+                skipped += skips[lo].offset - pos;
+                index = skips[lo].index;
+                pos = skips[lo].offset;
+                load();
+            }
+        }
+
+        while (!at_end() && doc_id < target)
+        {
+            next();
+        }
+    }
+
+    // Add the bytes this cursor has read so far to the thread's scan counter
+    void count_scanned() const
+    {
+        scanned_bytes_counter() += pos - term->offset - skipped;
+    }
+
+    // Decode the positions of the current document
+    void positions(vector<uint32_t> &out) const
+    {
+        out.clear();
+        size_t p = pos;
+        uint32_t position = 0;
+        for (uint32_t i = 0; i < tf; i++)
+        {
+            position += read_vbyte(data, p, end);
+            out.push_back(position);
+        }
+    }
+
+private:
+    void load()
+    {
+        if (at_end())
+            return;
+        doc_id = read_vbyte(data, pos, end);
+        tf = read_vbyte(data, pos, end);
+    }
+};
+
+// Decode only the doc IDs of a compressed posting list that fall in range
+inline void decode_doc_ids(const CompressedPostings &postings, const TermPostings &term, DocList &out,
+                           DocRange range = DocRange())
+{
+    out.clear();
+    PostingCursor cursor(postings, term);
+    if (range.begin > 0)
+        cursor.advance(range.begin);
+    else
+        out.reserve(term.doc_count);
+    for (; !cursor.at_end() && cursor.doc_id < range.end; cursor.next())
+    {
+        out.push_back(cursor.doc_id);
+    }
+    cursor.count_scanned();
+}
+
+// Intersect a decoded list with a compressed list, probing it via skips
+inline void intersect_list_cursor(const uint32_t *a, size_t na, PostingCursor cursor, DocList &out)
+{
+    for (size_t i = 0; i < na; i++)
+    {
+        cursor.advance(a[i]);
+        if (cursor.at_end())
+            break;
+        if (cursor.doc_id == a[i])
+            out.push_back(a[i]);
+    }
+    cursor.count_scanned();
+}
+
+// Subtract a compressed list from a decoded list, probing it via skips
+inline void difference_list_cursor(const uint32_t *a, size_t na, PostingCursor cursor, DocList &out)
+{
+    for (size_t i = 0; i < na; i++)
+    {
+        cursor.advance(a[i]);
+        if (cursor.at_end() || cursor.doc_id != a[i])
+            out.push_back(a[i]);
+    }
+    cursor.count_scanned();
+}
+
+// ---------------------------------------------------------------------------
+// n-way operators for flattened AND nodes
+// ---------------------------------------------------------------------------
+
+// Operand of an n-way operator: a decoded list or a compressed posting list
+struct ListOperand
+{
+    const uint32_t *list;             // Decoded doc IDs (nullptr for compressed operands)
+    size_t size;                      // List length or document frequency
+    const CompressedPostings *source; // Compressed operands only
+    const TermPostings *term;         // Compressed operands only
+    DocRange range;                   // Doc IDs of a compressed operand taken into account
+
+    ListOperand(const uint32_t *l, size_t n) : list(l), size(n), source(nullptr), term(nullptr) {}
+    ListOperand(const CompressedPostings &p, const TermPostings &t, DocRange r = DocRange())
+        : list(nullptr), size(t.doc_count), source(&p), term(&t), range(r) {}
+};
+
+inline bool operand_shorter(const ListOperand &a, const ListOperand &b)
+{
+    return a.size < b.size;
+}
+
+// Intersect (or subtract, if subtract is set) one operand into result.
+// Compressed operands much longer than result are probed through skips
+// instead of being decoded.
+inline void apply_list_operand(DocList &result, const ListOperand &operand, bool subtract,
+                               DocList &decoded, DocList &scratch)
+{
+    scratch.clear();
+    if (operand.term && operand.size >= GALLOP_RATIO * result.size())
+    {
+        PostingCursor cursor(*operand.source, *operand.term);
+        if (subtract)
+            difference_list_cursor(result.data(), result.size(), cursor, scratch);
+        else
+            intersect_list_cursor(result.data(), result.size(), cursor, scratch);
+    }
+    else
+    {
+        const uint32_t *list = operand.list;
+        size_t size = operand.size;
+        if (operand.term)
+        {
+            decode_doc_ids(*operand.source, *operand.term, decoded, operand.range);
+            list = decoded.data();
+            size = decoded.size();
+        }
+        if (subtract)
+            difference_lists(result.data(), result.size(), list, size, scratch);
+        else
+            intersect_lists(result.data(), result.size(), list, size, scratch);
+    }
+    result.swap(scratch);
+}
+
+// n-way intersection, shortest operand first, stopping once empty (sorts
+// operands; decoded and scratch are caller-owned buffers reused across calls)
+inline void intersect_many(vector<ListOperand> &operands, DocList &out, DocList &decoded, DocList &scratch)
+{
+    out.clear();
+    if (operands.empty())
+        return;
+
+    sort(operands.begin(), operands.end(), operand_shorter);
+
+    if (operands[0].term)
+        decode_doc_ids(*operands[0].source, *operands[0].term, out, operands[0].range);
+    else
+        out.assign(operands[0].list, operands[0].list + operands[0].size);
+
+    for (size_t i = 1; i < operands.size() && !out.empty(); i++)
+    {
+        apply_list_operand(out, operands[i], false, decoded, scratch);
+    }
+}
+
+// Subtract every operand from result
+inline void subtract_many(DocList &result, const vector<ListOperand> &operands, DocList &decoded, DocList &scratch)
+{
+    for (size_t i = 0; i < operands.size() && !result.empty(); i++)
+    {
+        apply_list_operand(result, operands[i], true, decoded, scratch);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// n-way union for large disjunctions
+// ---------------------------------------------------------------------------
+
+// Index of the lowest set bit (word must be non-zero)
+inline int lowest_bit(uint64_t word)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(word);
+#else
+    int bit = 0;
+    while ((word & 1) == 0)
+    {
+        word >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+// One bit per doc ID of a doc ID range
+struct DocBitmap
+{
+    vector<uint64_t> words;
+    uint32_t base;
+
+    DocBitmap() : base(0) {}
+
+    void reset(DocRange range)
+    {
+        base = range.begin;
+        words.assign((size_t(range.end - range.begin) + 63) / 64, 0);
+    }
+
+    void set(uint32_t doc_id)
+    {
+        uint32_t bit = doc_id - base;
+        words[bit >> 6] |= uint64_t(1) << (bit & 63);
+    }
+
+    // Append the set doc IDs in ascending order
+    void append_to(DocList &out) const
+    {
+        for (size_t w = 0; w < words.size(); w++)
+        {
+            uint64_t word = words[w];
+            while (word)
+            {
+                out.push_back(base + uint32_t(w * 64 + lowest_bit(word)));
+                word &= word - 1;
+            }
+        }
+    }
+};
+
+// Reusable buffers of union_many
+struct UnionScratch
+{
+    DocBitmap bitmap;
+    vector<DocList> decoded;
+    vector<pair<const uint32_t *, size_t>> lists;
+    vector<pair<uint32_t, uint32_t>> heap;
+    vector<size_t> next;
+};
+
+// Restore the min-heap property below position i
+inline void sift_down(vector<pair<uint32_t, uint32_t>> &heap, size_t i)
+{
+    size_t n = heap.size();
+    while (true)
+    {
+        size_t smallest = i;
+        size_t left = 2 * i + 1, right = left + 1;
+        if (left < n && heap[left] < heap[smallest])
+            smallest = left;
+        if (right < n && heap[right] < heap[smallest])
+            smallest = right;
+        if (smallest == i)
+            return;
+        swap(heap[i], heap[smallest]);
+        i = smallest;
+    }
+}
+
+// k-way merge of sorted lists through a min-heap of (doc ID, list)
+inline void union_heap(const vector<pair<const uint32_t *, size_t>> &lists, DocList &out,
+                       vector<pair<uint32_t, uint32_t>> &heap, vector<size_t> &next)
+{
+    heap.clear();
+    next.assign(lists.size(), 1);
+    for (size_t i = 0; i < lists.size(); i++)
+    {
+        if (lists[i].second > 0)
+            heap.push_back(make_pair(lists[i].first[0], uint32_t(i)));
+    }
+    for (size_t i = heap.size() / 2; i-- > 0;)
+    {
+        sift_down(heap, i);
+    }
+
+    bool any = false;
+    while (!heap.empty())
+    {
+        uint32_t doc_id = heap[0].first;
+        uint32_t list = heap[0].second;
+        if (!any || out.back() != doc_id)
+        {
+            out.push_back(doc_id);
+            any = true;
+        }
+
+        // Replace the top with the list's next doc (or drop the exhausted list)
+        if (next[list] < lists[list].second)
+        {
+            heap[0].first = lists[list].first[next[list]++];
+        }
+        else
+        {
+            heap[0] = heap.back();
+            heap.pop_back();
+        }
+        if (!heap.empty())
+            sift_down(heap, 0);
+    }
+}
+
+// n-way union over doc IDs in range: heap merge for sparse results, bitmap
+// accumulation once the estimated density passes 1/UNION_BITMAP_RATIO of it
+inline void union_many(const vector<ListOperand> &operands, DocRange range, DocList &out, UnionScratch &scratch)
+{
+    size_t universe_size = range.end - range.begin;
+    out.clear();
+
+    size_t total = 0;
+    for (const auto &operand : operands)
+    {
+        total += operand.size;
+    }
+    if (total == 0)
+        return;
+
+    if (operands.size() > 2 && total * UNION_BITMAP_RATIO >= universe_size)
+    {
+        DocBitmap &bitmap = scratch.bitmap;
+        bitmap.reset(range);
+        for (const auto &operand : operands)
+        {
+            if (operand.term)
+            {
+                PostingCursor cursor(*operand.source, *operand.term);
+                for (cursor.advance(range.begin); !cursor.at_end() && cursor.doc_id < range.end; cursor.next())
+                    bitmap.set(cursor.doc_id);
+                cursor.count_scanned();
+            }
+            else
+            {
+                for (size_t i = 0; i < operand.size; i++)
+                    bitmap.set(operand.list[i]);
+            }
+        }
+        out.reserve(min(total, universe_size));
+        bitmap.append_to(out);
+        return;
+    }
+
+    // Decode compressed operands, then merge
+    vector<DocList> &decoded = scratch.decoded;
+    vector<pair<const uint32_t *, size_t>> &lists = scratch.lists;
+    if (decoded.size() < operands.size())
+        decoded.resize(operands.size());
+    lists.clear();
+    size_t merged_total = 0;
+    for (size_t i = 0; i < operands.size(); i++)
+    {
+        if (operands[i].term)
+        {
+            decode_doc_ids(*operands[i].source, *operands[i].term, decoded[i], range);
+            lists.push_back(make_pair(decoded[i].data(), decoded[i].size()));
+        }
+        else
+        {
+            lists.push_back(make_pair(operands[i].list, operands[i].size));
+        }
+        merged_total += lists.back().second;
+    }
+
+    out.reserve(merged_total);
+    if (lists.size() == 1)
+        out.assign(lists[0].first, lists[0].first + lists[0].second);
+    else if (lists.size() == 2)
+        union_lists(lists[0].first, lists[0].second, lists[1].first, lists[1].second, out);
+    else
+        union_heap(lists, out, scratch.heap, scratch.next);
+}
+
+// Span of token positions [first, last] matched by a positional expression
+// (a single term occurrence has first == last)
+struct PositionSpan
+{
+    uint32_t first;
+    uint32_t last;
+
+    PositionSpan(uint32_t f = 0, uint32_t l = 0) : first(f), last(l) {}
+    bool operator<(const PositionSpan &other) const
+    {
+        return first != other.first ? first < other.first : last < other.last;
+    }
+    bool operator==(const PositionSpan &other) const { return first == other.first && last == other.last; }
+};
+
+// Keep the phrase starts s for which s + offset is a position of the next
+// phrase term (both lists sorted); filters starts in place
+inline void extend_phrase(vector<uint32_t> &starts, const vector<uint32_t> &positions, uint32_t offset)
+{
+    size_t kept = 0, j = 0;
+    for (size_t i = 0; i < starts.size(); i++)
+    {
+        uint64_t target = (uint64_t)starts[i] + offset;
+        while (j < positions.size() && positions[j] < target)
+            j++;
+        if (j == positions.size())
+            break;
+        if (positions[j] == target)
+            starts[kept++] = starts[i];
+    }
+    starts.resize(kept);
+}
+
+// NEAR/window join: every pair of non-overlapping spans from a and b (both
+// sorted) at most window positions apart, merged into one covering span
+inline void join_near_spans(const vector<PositionSpan> &a, const vector<PositionSpan> &b, uint32_t window,
+                            vector<PositionSpan> &out)
+{
+    out.clear();
+    uint32_t longest = 0;
+    for (const PositionSpan &span : b)
+    {
+        longest = max(longest, span.last - span.first);
+    }
+
+    size_t lo = 0;
+    for (const PositionSpan &x : a)
+    {
+        // Spans of b starting this far before x cannot reach it
+        while (lo < b.size() && (uint64_t)b[lo].first + longest + window < x.first)
+            lo++;
+        for (size_t j = lo; j < b.size() && b[j].first <= (uint64_t)x.last + window; j++)
+        {
+            const PositionSpan &y = b[j];
+            bool near = (y.first > x.last && y.first - x.last <= window) ||
+                        (x.first > y.last && x.first - y.last <= window);
+            if (near)
+                out.push_back(PositionSpan(min(x.first, y.first), max(x.last, y.last)));
+        }
+    }
+    sort(out.begin(), out.end());
+    out.erase(unique(out.begin(), out.end()), out.end());
+}
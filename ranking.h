@@ -0,0 +1,164 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <fstream>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+using namespace std;
+
+// BM25 parameters (stored in bm25.bin so build and retrieval always agree)
+const float BM25_K1 = 1.2f;
+const float BM25_B = 0.75f;
+
+// Postings per score block; each block records its last doc ID and the
+// highest score any of its postings can reach (block-max WAND)
+const uint32_t SCORE_BLOCK_SIZE = 64;
+
+// Collection statistics and document lengths (in indexed tokens). A shard
+// keeps its own doc lengths but the whole collection's size and average
+// length, so its scores are those of the unsharded index.
+struct RankingStats
+{
+    float k1;
+    float b;
+    uint64_t collection_size; // Documents idf is computed over
+    double avg_doc_length;
+    vector<uint32_t> doc_lengths; // Indexed by doc ID
+
+    RankingStats() : k1(BM25_K1), b(BM25_B), collection_size(0), avg_doc_length(0) {}
+};
+
+// Upper bound of one posting in a score block
+struct ScoreBlock
+{
+    uint32_t last_doc; // Doc ID of the block's last posting
+    float max_score;   // Highest BM25 score (unit query weight) in the block
+};
+
+// Score upper bounds of one term: overall and per block
+struct TermScoreBounds
+{
+    uint32_t df; // Documents of the collection holding the term (for idf)
+    float max_score;
+    vector<ScoreBlock> blocks;
+
+    TermScoreBounds() : df(0), max_score(0) {}
+};
+
+// Inverse document frequency (Lucene variant, always positive)
+inline double bm25_idf(uint32_t df, uint64_t num_docs)
+{
+    return log(1.0 + (num_docs - df + 0.5) / (df + 0.5));
+}
+
+// BM25 contribution of one term occurring tf times in a document
+inline double bm25_score(double idf, uint32_t tf, uint32_t doc_length, const RankingStats &stats)
+{
+    double norm = stats.k1 * (1.0 - stats.b + stats.b * doc_length / stats.avg_doc_length);
+    return idf * tf * (stats.k1 + 1.0) / (tf + norm);
+}
+
+// Round a bound up so the float never undercuts the double it stands for
+inline float score_upper_bound(double score)
+{
+    float bound = (float)score;
+    return bound < score ? nextafterf(bound, INFINITY) : bound;
+}
+
+// Collection size and average document length from per-document lengths
+inline void finish_ranking_stats(RankingStats &stats)
+{
+    stats.collection_size = stats.doc_lengths.size();
+    double total = 0;
+    for (uint32_t length : stats.doc_lengths)
+    {
+        total += length;
+    }
+    stats.avg_doc_length = stats.doc_lengths.empty() ? 1.0 : max(1.0, total / stats.doc_lengths.size());
+}
+
+// Score bounds of a posting list given as (doc ID, tf) pairs in doc order,
+// for a term found in df documents of the collection
+inline TermScoreBounds compute_score_bounds(const vector<pair<uint32_t, uint32_t>> &postings, uint32_t df,
+                                            const RankingStats &stats)
+{
+    TermScoreBounds bounds;
+    bounds.df = df;
+    double idf = bm25_idf(df, stats.collection_size);
+    for (size_t i = 0; i < postings.size(); i++)
+    {
+        if (i % SCORE_BLOCK_SIZE == 0)
+            bounds.blocks.push_back(ScoreBlock{0, 0});
+
+        ScoreBlock &block = bounds.blocks.back();
+        float score = score_upper_bound(bm25_score(idf, postings[i].second, stats.doc_lengths[postings[i].first], stats));
+        block.last_doc = postings[i].first;
+        block.max_score = max(block.max_score, score);
+        bounds.max_score = max(bounds.max_score, score);
+    }
+    return bounds;
+}
+
+const uint32_t RANKING_MAGIC = 0x35324D42; // "BM25"
+const uint32_t RANKING_VERSION = 2;
+
+// bm25.bin layout (little-endian): magic u32, version u32, k1 f32, b f32,
+// collection_size u64, avg_doc_length f64, num_docs u32,
+// doc_lengths[num_docs] u32, then per term in sorted term order: df u32,
+// max_score f32, block_count u32, and block_count x (last_doc u32,
+// max_score f32)
+inline void write_ranking_file(const string &path, const RankingStats &stats, const vector<TermScoreBounds> &terms)
+{
+    ofstream out(path, ios::binary);
+    uint32_t header[] = {RANKING_MAGIC, RANKING_VERSION};
+    uint32_t num_docs = stats.doc_lengths.size();
+    out.write(reinterpret_cast<const char *>(header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(&stats.k1), sizeof(float));
+    out.write(reinterpret_cast<const char *>(&stats.b), sizeof(float));
+    out.write(reinterpret_cast<const char *>(&stats.collection_size), sizeof(uint64_t));
+    out.write(reinterpret_cast<const char *>(&stats.avg_doc_length), sizeof(double));
+    out.write(reinterpret_cast<const char *>(&num_docs), sizeof(uint32_t));
+    out.write(reinterpret_cast<const char *>(stats.doc_lengths.data()), num_docs * sizeof(uint32_t));
+    for (const TermScoreBounds &bounds : terms)
+    {
+        uint32_t block_count = bounds.blocks.size();
+        out.write(reinterpret_cast<const char *>(&bounds.df), sizeof(uint32_t));
+        out.write(reinterpret_cast<const char *>(&bounds.max_score), sizeof(float));
+        out.write(reinterpret_cast<const char *>(&block_count), sizeof(uint32_t));
+        out.write(reinterpret_cast<const char *>(bounds.blocks.data()), block_count * sizeof(ScoreBlock));
+    }
+}
+
+// Read bm25.bin; term bounds come back in sorted term order. False for a
+// missing file or one of another version (bm25.bin of older builds)
+inline bool read_ranking_file(const string &path, RankingStats &stats, vector<TermScoreBounds> &terms)
+{
+    ifstream in(path, ios::binary);
+    uint32_t header[2], num_docs = 0;
+    if (!in.read(reinterpret_cast<char *>(header), sizeof(header)) || header[0] != RANKING_MAGIC ||
+        header[1] != RANKING_VERSION)
+        return false;
+
+    in.read(reinterpret_cast<char *>(&stats.k1), sizeof(float));
+    in.read(reinterpret_cast<char *>(&stats.b), sizeof(float));
+    in.read(reinterpret_cast<char *>(&stats.collection_size), sizeof(uint64_t));
+    in.read(reinterpret_cast<char *>(&stats.avg_doc_length), sizeof(double));
+    in.read(reinterpret_cast<char *>(&num_docs), sizeof(uint32_t));
+    stats.doc_lengths.resize(num_docs);
+    in.read(reinterpret_cast<char *>(stats.doc_lengths.data()), num_docs * sizeof(uint32_t));
+
+    terms.clear();
+    TermScoreBounds bounds;
+    uint32_t block_count;
+    while (in.read(reinterpret_cast<char *>(&bounds.df), sizeof(uint32_t)) &&
+           in.read(reinterpret_cast<char *>(&bounds.max_score), sizeof(float)) &&
+           in.read(reinterpret_cast<char *>(&block_count), sizeof(uint32_t)))
+    {
+        bounds.blocks.resize(block_count);
+        in.read(reinterpret_cast<char *>(bounds.blocks.data()), block_count * sizeof(ScoreBlock));
+        terms.push_back(bounds);
+    }
+    return true;
+}
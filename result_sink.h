@@ -0,0 +1,277 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+using namespace std;
+
+// Bytes collected before a buffer is handed to the file
+const size_t RESULT_BUFFER_SIZE = 1 << 20;
+
+// Full buffers the background writer may fall behind by before results block
+const size_t RESULT_QUEUE_DEPTH = 4;
+
+// Result file formats
+enum ResultFormat
+{
+    FORMAT_DOCIDS, // qid docid rank score
+    FORMAT_TREC,   // qid Q0 docid rank score run_tag (trec_eval run file)
+    FORMAT_BINARY  // Doc IDs (and float scores) per query, see ResultSink
+};
+
+// Buffered result writer. Rows are formatted into a large buffer that is
+// written out only when full (or on flush), never once per line; with async
+// set, full buffers go to a background thread so formatting and writing overlap.
+//
+// Binary layout (little-endian): "IRRB", then per query a record
+// qid_length:u32, qid bytes, flags:u32 (1 = scored, 2 = count only), n:u32,
+// followed by n rows of doc_id:u32 (plus score:f32 when scored); a count-only
+// record carries the count in n and no rows. Doc IDs index doc_map.json.
+class ResultSink
+{
+public:
+    ResultSink(ResultFormat format, bool ranked, bool async)
+        : format_(format), ranked_(ranked), async_(async), file_(nullptr), owns_file_(false),
+          failed_(false), writing_(false), stopping_(false) {}
+
+    ~ResultSink() { close(); }
+
+    // Open path for writing ("-" = standard output)
+    bool open(const string &path)
+    {
+        if (path == "-")
+            return open(stdout);
+        FILE *file = fopen(path.c_str(), "wb");
+        owns_file_ = file != nullptr;
+        return file && open(file);
+    }
+
+    // Write to a stream opened elsewhere (stdout, stderr)
+    bool open(FILE *stream)
+    {
+        file_ = stream;
+        if (!file_)
+            return false;
+
+        buffer_.reserve(RESULT_BUFFER_SIZE + 4096);
+        if (format_ == FORMAT_BINARY)
+            buffer_.append("IRRB", 4);
+        if (async_)
+            writer_ = thread(&ResultSink::writer_loop, this);
+        return true;
+    }
+
+    bool is_open() const { return file_ != nullptr; }
+
+    // Start a query with n result rows (only binary records need n up front)
+    void begin_query(const string &qid, size_t n)
+    {
+        if (format_ == FORMAT_BINARY)
+            append_record_header(qid, ranked_ ? 1 : 0, n);
+    }
+
+    // One result row; score is ignored in Boolean mode (written as 1)
+    void write_result(const string &qid, uint32_t doc_id, const string &doc_name, size_t rank, double score)
+    {
+        if (format_ == FORMAT_BINARY)
+        {
+            append_binary(doc_id);
+            if (ranked_)
+                append_binary((float)score);
+        }
+        else
+        {
+            buffer_ += qid;
+            buffer_ += format_ == FORMAT_TREC ? " Q0 " : " ";
+            buffer_ += doc_name;
+            buffer_ += ' ';
+            append_number(rank);
+            buffer_ += ' ';
+            append_score(score);
+            if (format_ == FORMAT_TREC)
+                buffer_ += ranked_ ? " bm25" : " boolean";
+            buffer_ += '\n';
+        }
+        reserve_room();
+    }
+
+    // Match count of a count-only query ("qid count" in the text formats)
+    void write_count(const string &qid, size_t count)
+    {
+        if (format_ == FORMAT_BINARY)
+        {
+            append_record_header(qid, 2, count);
+        }
+        else
+        {
+            buffer_ += qid;
+            buffer_ += ' ';
+            append_number(count);
+            buffer_ += '\n';
+        }
+        reserve_room();
+    }
+
+    // Preformatted text such as a JSON line (text formats only)
+    void write_text(const string &text)
+    {
+        buffer_ += text;
+        reserve_room();
+    }
+
+    // Push everything written so far to the file (server mode, per query)
+    void flush()
+    {
+        dispatch(true);
+    }
+
+    // Flush, stop the writer thread and close the file; false on write errors
+    bool close()
+    {
+        if (!file_)
+            return !failed_;
+
+        dispatch(true);
+        if (writer_.joinable())
+        {
+            {
+                lock_guard<mutex> guard(lock_);
+                stopping_ = true;
+            }
+            changed_.notify_all();
+            writer_.join();
+        }
+        if (owns_file_ && fclose(file_) != 0)
+            failed_ = true;
+        file_ = nullptr;
+        return !failed_;
+    }
+
+private:
+    void append_number(size_t value)
+    {
+        char digits[24];
+        size_t n = 0;
+        do
+        {
+            digits[n++] = '0' + value % 10;
+            value /= 10;
+        } while (value > 0);
+        while (n > 0)
+        {
+            buffer_ += digits[--n];
+        }
+    }
+
+    void append_score(double score)
+    {
+        if (!ranked_)
+        {
+            buffer_ += '1';
+            return;
+        }
+        char text[32];
+        int length = snprintf(text, sizeof(text), "%.4f", score);
+        buffer_.append(text, length);
+    }
+
+    template <typename T>
+    void append_binary(T value)
+    {
+        buffer_.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    void append_record_header(const string &qid, uint32_t flags, size_t n)
+    {
+        append_binary((uint32_t)qid.size());
+        buffer_ += qid;
+        append_binary(flags);
+        append_binary((uint32_t)n);
+    }
+
+    // Hand the buffer over once it is full
+    void reserve_room()
+    {
+        if (buffer_.size() >= RESULT_BUFFER_SIZE)
+            dispatch(false);
+    }
+
+    // Write the buffer (directly, or through the background writer)
+    void dispatch(bool flush_file)
+    {
+        if (!file_)
+            return;
+
+        if (!async_)
+        {
+            write_buffer(buffer_);
+            buffer_.clear();
+            if (flush_file && fflush(file_) != 0)
+                failed_ = true;
+            return;
+        }
+
+        string full;
+        full.reserve(RESULT_BUFFER_SIZE + 4096);
+        full.swap(buffer_);
+        unique_lock<mutex> guard(lock_);
+        changed_.wait(guard, [this]
+                      { return pending_.size() < RESULT_QUEUE_DEPTH; });
+        pending_.push_back(move(full));
+        changed_.notify_all();
+        if (flush_file)
+        {
+            // Wait until the writer has drained the queue, then flush the stream
+            changed_.wait(guard, [this]
+                          { return pending_.empty() && !writing_; });
+            if (fflush(file_) != 0)
+                failed_ = true;
+        }
+    }
+
+    void write_buffer(const string &data)
+    {
+        if (!data.empty() && fwrite(data.data(), 1, data.size(), file_) != data.size())
+            failed_ = true;
+    }
+
+    void writer_loop()
+    {
+        unique_lock<mutex> guard(lock_);
+        while (true)
+        {
+            changed_.wait(guard, [this]
+                          { return stopping_ || !pending_.empty(); });
+            if (pending_.empty())
+                return;
+
+            string data = move(pending_.front());
+            pending_.pop_front();
+            writing_ = true;
+            guard.unlock();
+            write_buffer(data);
+            guard.lock();
+            writing_ = false;
+            changed_.notify_all();
+        }
+    }
+
+    ResultFormat format_;
+    bool ranked_;
+    bool async_;
+    FILE *file_;
+    bool owns_file_;
+    bool failed_;
+    string buffer_;
+
+    // Background writer state
+    thread writer_;
+    mutex lock_;
+    condition_variable changed_;
+    deque<string> pending_;
+    bool writing_;
+    bool stopping_;
+};
@@ -6,7 +6,6 @@
 #include <cstdint>
 #include <sstream>
 #include <algorithm>
-#include <unordered_set>
 #include <set>
 #include <stack>
 #ifdef _WIN32
@@ -16,26 +15,181 @@
 #endif
 #include "tokenizer.h"
 #include "utilities.h"
+#include "postings.h"
+#include "parallel.h"
+#include "ranking.h"
+#include "result_sink.h"
+#include "wildcard.h"
+#include "line_reader.h"
+#include "analyzer.h"
+#include "shards.h"
+#include <queue>
+#include <deque>
+#include <cstdio>
+#include <chrono>
+#include <cstring>
 
 using namespace std;
 
-// QueryNode structure for AST
+// Types of query tokens (and of the AST nodes built from them)
+enum QueryTokenType
+{
+    TOKEN_TERM,     // Single term
+    TOKEN_PHRASE,   // Quoted phrase of several terms, joined by single spaces
+    TOKEN_WILDCARD, // Term pattern with * wildcards (covid*, *virus)
+    TOKEN_AND,
+    TOKEN_OR,
+    TOKEN_NOT,
+    TOKEN_NEAR,     // NEAR/k
+    TOKEN_LPAREN,
+    TOKEN_RPAREN
+};
+
+// Query token produced by the lexer
+struct QueryToken
+{
+    QueryTokenType type;
+    string text;                  // Term, phrase or canonical operator ("AND", "NEAR/3", "(")
+    const TermPostings *postings; // Dictionary entry of a term (nullptr if not indexed)
+    bool resolved;                // True if postings was looked up while lexing
+};
+
+// QueryNode structure for AST; nodes live in a QueryArena and do not own their children
 struct QueryNode
 {
     string value; // operator or term
+    QueryTokenType type;
+    const TermPostings *postings; // Term nodes resolved by the lexer
+    bool resolved;
     QueryNode *left;
     QueryNode *right;
 
-    QueryNode(string v) : value(v), left(nullptr), right(nullptr) {}
-    ~QueryNode()
+    QueryNode() : type(TOKEN_TERM), postings(nullptr), resolved(false), left(nullptr), right(nullptr) {}
+};
+
+// Token buffer of the query lexer; tokens, and their string capacity, are
+// reused by the next query
+struct QueryTokens
+{
+    vector<QueryToken> items;
+    size_t count;
+    string word;   // Word being lexed
+    string phrase; // Phrase being lexed
+
+    QueryTokens() : count(0) {}
+
+    const QueryToken &operator[](size_t i) const { return items[i]; }
+};
+
+// Flat node storage for parsed queries, filled in postfix order (children
+// before their parent). Nodes, and the capacity of their strings, are reused
+// by the next parse instead of being allocated and freed per node.
+struct QueryArena
+{
+    vector<QueryNode> nodes;
+    vector<QueryNode *> stack;  // Operand stack of build_tree
+    QueryTokens tokens;         // Lexer output
+    vector<uint32_t> postfix;   // Token indices in postfix order
+    vector<uint32_t> operators; // Operator stack of the shunting-yard pass
+    size_t used;
+
+    QueryArena() : used(0) {}
+
+    // Make room for n nodes; invalidates nodes handed out before
+    void reset(size_t n)
     {
-        delete left;
-        delete right;
+        if (nodes.size() < n)
+            nodes.resize(n);
+        stack.clear();
+        used = 0;
+    }
+
+    QueryNode *make(const string &value, QueryTokenType type)
+    {
+        QueryNode &node = nodes[used++];
+        node.value = value;
+        node.type = type;
+        node.postings = nullptr;
+        node.resolved = false;
+        node.left = node.right = nullptr;
+        return &node;
     }
 };
 
 vector<string> global_all_docs; // Global vector to store all document names
 
+// Read-only search structures shared by all queries
+struct SearchIndex
+{
+    vector<string> doc_names;    // Doc ID -> document name
+    bool names_sorted;           // Doc ID order equals lexicographic name order
+    CompressedPostings postings; // Term dictionary and skip-aware posting lists
+    CompressedPostings biwords;  // Optional postings of adjacent term pairs ("a b")
+    RankingStats ranking;        // Document lengths for BM25 (ranked mode)
+    map<string, TermScoreBounds> score_bounds; // Per-term BM25 upper bounds (ranked mode)
+    vector<const string *> term_list;          // Dictionary terms in sorted order (wildcards)
+    vector<const TermPostings *> term_entries; // Dictionary entry of each term_list term
+    vector<PermutermEntry> permuterm;          // Rotations of term_list (empty: wildcards scan)
+    WordTable analyzer;                        // Stopwords and operator words of analyzer.bin
+    bool has_analyzer;                         // analyzer.bin was loaded
+    int shard;                                 // Shard number in a sharded index (-1 if not a shard)
+    vector<uint32_t> merged_doc_ids;           // Shard doc ID -> doc ID in the merged name table
+
+    SearchIndex() : names_sorted(true), has_analyzer(false), shard(-1) {}
+};
+
+// Index the dictionary by sorted position for wildcard expansion
+void build_term_list(SearchIndex &index)
+{
+    index.term_list.clear();
+    index.term_entries.clear();
+    for (const auto &entry : index.postings.terms)
+    {
+        index.term_list.push_back(&entry.first);
+        index.term_entries.push_back(&entry.second);
+    }
+}
+
+SearchIndex global_search_index; // Loaded alongside the decompressed index
+
+// Shards of a document-partitioned index (empty for a single index); the
+// global search index then holds only the merged doc names and the analyzer
+vector<SearchIndex> global_shards;
+
+// Optional command-line settings beyond the three required arguments
+struct RetrievalOptions
+{
+    unsigned threads;       // Query evaluation threads (0 = one per hardware thread)
+    unsigned query_threads; // Threads per query when queries run one at a time
+    bool ranked;            // Rank by BM25 instead of Boolean matching
+    size_t top_k;           // Results per query in ranked mode
+    size_t limit;           // Default per-query result limit (queries may override)
+    bool count_only;        // Default per-query count-only mode (queries may override)
+    ResultFormat format;    // Result file format
+    bool to_stdout;         // Stream batch results to standard output instead of a file
+    bool async_output;      // Write result buffers on a background thread
+    bool explain;           // Default per-query EXPLAIN mode: print plans, do not evaluate
+    bool profile;           // Default per-query PROFILE mode: evaluate and print plan costs
+
+    RetrievalOptions()
+        : threads(1), query_threads(1), ranked(false), top_k(1000), limit(SIZE_MAX), count_only(false),
+          format(FORMAT_DOCIDS), to_stdout(false), async_output(false), explain(false), profile(false) {}
+};
+
+RetrievalOptions global_options;
+
+// Progress messages (standard error while results stream to standard output)
+ostream &status_stream()
+{
+    return global_options.to_stdout ? cerr : cout;
+}
+
+// Queries handed to the thread pool per round; bounds the reorder buffer
+const size_t QUERY_BATCH_WINDOW = 4096;
+
+// Postings a plan must read before it is split into parallel doc ID ranges
+const size_t PARALLEL_QUERY_MIN_POSTINGS = 1 << 16;
+
 // Variable-byte decoding function
 uint32_t decode_vbyte(const vector<uint8_t> &data, size_t &pos)
 {
@@ -122,6 +276,50 @@ string unescape_json_string(const string &s)
     return result;
 }
 
+// Find the closing quote of a JSON string starting at start, skipping
+// escaped characters (titles may contain \" around phrases)
+size_t find_json_string_end(const string &s, size_t start)
+{
+    for (size_t i = start; i < s.length(); i++)
+    {
+        if (s[i] == '\\')
+            i++;
+        else if (s[i] == '"')
+            return i;
+    }
+    return string::npos;
+}
+
+// Turn \" back into a quote (phrase delimiters in titles). Other escapes are
+// kept as-is, matching document text, which is indexed without unescaping.
+string unescape_json_quotes(const string &s)
+{
+    string result;
+    for (size_t i = 0; i < s.length(); i++)
+    {
+        if (s[i] == '\\' && i + 1 < s.length() && s[i + 1] == '"')
+            i++;
+        result += s[i];
+    }
+    return result;
+}
+
+// String value of a field in a one-line JSON object, quotes unescaped ("" if absent)
+string extract_json_string(const string &line, const string &field)
+{
+    size_t key_pos = line.find("\"" + field + "\"");
+    if (key_pos == string::npos)
+        return "";
+    size_t colon_pos = line.find(':', key_pos);
+    size_t value_start = colon_pos == string::npos ? string::npos : line.find('"', colon_pos);
+    if (value_start == string::npos)
+        return "";
+    size_t value_end = find_json_string_end(line, value_start + 1);
+    if (value_end == string::npos)
+        return "";
+    return unescape_json_quotes(line.substr(value_start + 1, value_end - value_start - 1));
+}
+
 // Parse metadata.json manually
 map<string, pair<size_t, size_t>> parse_metadata(const string &json_content)
 {
@@ -204,12 +402,43 @@ string escape_json_string(const string &s)
     return result;
 }
 
+// Helper function to check if a token is a proximity operator (NEAR/k)
+bool is_near_operator(const string &token)
+{
+    if (token.size() < 6 || token.find_first_not_of("0123456789", 5) != string::npos)
+        return false;
+    string upper_prefix = token.substr(0, 5);
+    transform(upper_prefix.begin(), upper_prefix.end(), upper_prefix.begin(), ::toupper);
+    return upper_prefix == "NEAR/";
+}
+
+// Maximum distance in positions allowed by a NEAR/k operator. Any k is a
+// valid operator: windows past UINT32_MAX (longer than any document) clamp
+// to it, strtoull saturating instead of throwing on overlong digit runs
+uint32_t near_window(const string &token)
+{
+    unsigned long long window = strtoull(token.c_str() + 5, nullptr, 10);
+    return window > UINT32_MAX ? UINT32_MAX : (uint32_t)window;
+}
+
+// WordClass flags of an AND / OR / NOT token in any letter case (0 for
+// anything else), looked up in the operator perfect hash
+uint8_t operator_class(const string &token)
+{
+    char folded[4];
+    if (token.size() > sizeof(folded))
+        return 0;
+    for (size_t i = 0; i < token.size(); i++)
+    {
+        folded[i] = tolower((unsigned char)token[i]);
+    }
+    return operator_words().lookup(folded, token.size());
+}
+
 // Helper function to check if a token is a Boolean operator
 bool is_operator(const string &token)
 {
-    string upper_token = token;
-    transform(upper_token.begin(), upper_token.end(), upper_token.begin(), ::toupper);
-    return upper_token == "AND" || upper_token == "OR" || upper_token == "NOT";
+    return operator_class(token) != 0 || is_near_operator(token);
 }
 
 // Helper function to check if a token is a parenthesis
@@ -218,108 +447,237 @@ bool is_parenthesis(const string &token)
     return token == "(" || token == ")";
 }
 
-// Helper function to check if a token is a term (not operator or parenthesis)
-bool is_term(const string &token)
+// Phrase terms are joined by single spaces into one token (terms never
+// contain whitespace); a one-word phrase is just that term
+bool is_phrase(const string &token)
 {
-    return !is_operator(token) && !is_parenthesis(token);
+    return token.find(' ') != string::npos;
 }
 
-// Query preprocessing function for Task 4.2
-vector<string> preprocess_query(const string &title, const unordered_set<string> &stopwords)
+// True for a term with * wildcards around at least one other character
+bool is_wildcard(const string &token)
 {
-    if (title.empty())
-    {
-        return vector<string>();
-    }
+    return token.find(WILDCARD) != string::npos && token.find_first_not_of(WILDCARD) != string::npos;
+}
+
+// Type of a string token (string-based parser API)
+QueryTokenType classify_token(const string &token)
+{
+    if (is_near_operator(token))
+        return TOKEN_NEAR;
+    uint8_t classes = operator_class(token);
+    if (classes & WORD_AND)
+        return TOKEN_AND;
+    if (classes & WORD_OR)
+        return TOKEN_OR;
+    if (classes & WORD_NOT)
+        return TOKEN_NOT;
+    if (token == "(")
+        return TOKEN_LPAREN;
+    if (token == ")")
+        return TOKEN_RPAREN;
+    if (is_phrase(token))
+        return TOKEN_PHRASE;
+    return is_wildcard(token) ? TOKEN_WILDCARD : TOKEN_TERM;
+}
+
+bool is_operand_token(QueryTokenType type)
+{
+    return type == TOKEN_TERM || type == TOKEN_PHRASE || type == TOKEN_WILDCARD;
+}
+
+bool is_operator_token(QueryTokenType type)
+{
+    return type == TOKEN_AND || type == TOKEN_OR || type == TOKEN_NOT || type == TOKEN_NEAR;
+}
 
-    // Step 1: Add spaces around parentheses
-    string modified_title = title;
+// Reuse the next token slot
+QueryToken &new_query_token(QueryTokens &tokens, QueryTokenType type)
+{
+    if (tokens.count == tokens.items.size())
+        tokens.items.push_back(QueryToken());
+    QueryToken &token = tokens.items[tokens.count++];
+    token.type = type;
+    token.text.clear();
+    token.postings = nullptr;
+    token.resolved = false;
+    return token;
+}
 
-    // Replace ( with " ( "
-    size_t pos = 0;
-    while ((pos = modified_title.find('(', pos)) != string::npos)
+// Append a token, first inserting the implicit AND between adjacent
+// operands: term term, term (, ) term, ) ( and term NOT
+QueryToken &append_query_token(QueryTokens &tokens, QueryTokenType type)
+{
+    if (tokens.count > 0)
     {
-        modified_title.replace(pos, 1, " ( ");
-        pos += 3;
+        QueryTokenType previous = tokens.items[tokens.count - 1].type;
+        bool opens_operand = is_operand_token(type) || type == TOKEN_LPAREN;
+        if ((is_operand_token(previous) && (opens_operand || type == TOKEN_NOT)) ||
+            (previous == TOKEN_RPAREN && opens_operand))
+        {
+            new_query_token(tokens, TOKEN_AND).text = "AND";
+        }
     }
+    return new_query_token(tokens, type);
+}
 
-    // Replace ) with " ) "
-    pos = 0;
-    while ((pos = modified_title.find(')', pos)) != string::npos)
+// Append one normalized word (or a one-word phrase) with its WordClass flags:
+// and / or / not are operators, anything else is a term, resolved against the
+// dictionary if given
+void append_word_token(QueryTokens &tokens, const string &word, uint8_t classes, const CompressedPostings *dictionary)
+{
+    QueryTokenType type = TOKEN_TERM;
+    if (classes & WORD_AND)
+        type = TOKEN_AND;
+    else if (classes & WORD_OR)
+        type = TOKEN_OR;
+    else if (classes & WORD_NOT)
+        type = TOKEN_NOT;
+    else if (word == "(" || word == ")")
+        type = word == "(" ? TOKEN_LPAREN : TOKEN_RPAREN;
+
+    QueryToken &token = append_query_token(tokens, type);
+    if (type == TOKEN_TERM)
     {
-        modified_title.replace(pos, 1, " ) ");
-        pos += 3;
+        token.text = word;
+        if (dictionary)
+        {
+            token.postings = find_term(*dictionary, word);
+            token.resolved = true;
+        }
     }
-
-    // Step 2: Tokenize using existing tokenizer
-    vector<string> tokens = tokenize(modified_title, stopwords);
-
-    if (tokens.empty())
+    else
     {
-        return vector<string>();
+        token.text = type == TOKEN_AND ? "AND" : type == TOKEN_OR ? "OR" : type == TOKEN_NOT ? "NOT" : word;
     }
+}
 
-    // Step 3: Canonicalize operators (convert to uppercase)
-    for (string &token : tokens)
+// True for a NEAR/k operator in title[begin, end)
+bool is_near_word(const string &title, size_t begin, size_t end)
+{
+    if (end - begin < 6)
+        return false;
+    for (size_t i = 0; i < 5; i++)
+    {
+        if (toupper((unsigned char)title[begin + i]) != "NEAR/"[i])
+            return false;
+    }
+    for (size_t i = begin + 5; i < end; i++)
     {
-        string upper_token = token;
-        transform(upper_token.begin(), upper_token.end(), upper_token.begin(), ::toupper);
+        if (!isdigit((unsigned char)title[i]))
+            return false;
+    }
+    return true;
+}
 
-        if (upper_token == "AND" || upper_token == "OR" || upper_token == "NOT")
+// Lex one whitespace-delimited word title[begin, end). Terms are normalized
+// like tokenize() does for documents (next_token): case-folded, split at
+// digits and Unicode spaces, stopwords dropped. Outside phrases NEAR/k is recognized first (before its digits go).
+// One stopwords lookup per word both drops stopwords and spots operators.
+void lex_word(const string &title, size_t begin, size_t end, bool in_phrase, const WordTable &stopwords,
+              const CompressedPostings *dictionary, QueryTokens &tokens)
+{
+    if (!in_phrase && is_near_word(title, begin, end))
+    {
+        QueryToken &token = append_query_token(tokens, TOKEN_NEAR);
+        for (size_t i = begin; i < end; i++)
         {
-            token = upper_token;
+            token.text += toupper((unsigned char)title[i]);
         }
-        // Parentheses remain as-is: "(" and ")"
+        return;
     }
 
-    // Step 4: Insert implicit AND operators
-    vector<string> result;
-
-    for (size_t i = 0; i < tokens.size(); i++)
+    string &word = tokens.word;
+    size_t i = begin;
+    while (next_token(title.data(), end, i, word))
     {
-        result.push_back(tokens[i]);
+        uint8_t classes = stopwords.lookup(word);
+        if (classes & WORD_STOPWORD)
+            continue;
 
-        // Check if we need to insert AND after current token
-        if (i + 1 < tokens.size())
+        if (!in_phrase && word.find(WILDCARD) != string::npos)
+        {
+            // Wildcard patterns expand at plan time; a bare * matches nothing
+            if (is_wildcard(word))
+                append_query_token(tokens, TOKEN_WILDCARD).text = word;
+            continue;
+        }
+        if (!in_phrase)
         {
-            const string &current = tokens[i];
-            const string &next = tokens[i + 1];
+            append_word_token(tokens, word, classes, dictionary);
+            continue;
+        }
+        if (!tokens.phrase.empty())
+            tokens.phrase += ' ';
+        tokens.phrase += word;
+    }
+}
 
-            bool insert_and = false;
+// Emit the phrase collected so far: several terms form a phrase token, a
+// single one is an ordinary word
+void finish_phrase(QueryTokens &tokens, const WordTable &stopwords, const CompressedPostings *dictionary)
+{
+    if (tokens.phrase.empty())
+        return;
+    if (is_phrase(tokens.phrase))
+        append_query_token(tokens, TOKEN_PHRASE).text = tokens.phrase;
+    else
+        append_word_token(tokens, tokens.phrase, stopwords.lookup(tokens.phrase), dictionary);
+    tokens.phrase.clear();
+}
 
-            // Case 1: term term
-            if (is_term(current) && is_term(next))
-            {
-                insert_and = true;
-            }
-            // Case 2: term (
-            else if (is_term(current) && next == "(")
-            {
-                insert_and = true;
-            }
-            // Case 3: ) term
-            else if (current == ")" && is_term(next))
-            {
-                insert_and = true;
-            }
-            // Case 4: ) (
-            else if (current == ")" && next == "(")
-            {
-                insert_and = true;
-            }
-            // Case 5: term NOT
-            else if (is_term(current) && next == "NOT")
-            {
-                insert_and = true;
-            }
+// One-pass query lexer: splits free text and "quoted phrases" (an
+// unterminated quote runs to the end), emits typed tokens with implicit ANDs
+// inserted on the fly, and resolves terms against dictionary (if not null)
+void lex_query(const string &title, const WordTable &stopwords, const CompressedPostings *dictionary,
+               QueryTokens &tokens)
+{
+    tokens.count = 0;
+    tokens.phrase.clear();
+    bool in_phrase = false;
+    size_t word_begin = string::npos;
 
-            if (insert_and)
-            {
-                result.push_back("AND");
-            }
+    for (size_t i = 0; i <= title.size(); i++)
+    {
+        char c = i < title.size() ? title[i] : '"';
+        bool paren = !in_phrase && (c == '(' || c == ')');
+        bool boundary = c == '"' || paren || isspace((unsigned char)c);
+        if (!boundary)
+        {
+            if (word_begin == string::npos)
+                word_begin = i;
+            continue;
+        }
+
+        if (word_begin != string::npos)
+        {
+            lex_word(title, word_begin, i, in_phrase, stopwords, dictionary, tokens);
+            word_begin = string::npos;
+        }
+        if (paren)
+        {
+            append_query_token(tokens, c == '(' ? TOKEN_LPAREN : TOKEN_RPAREN).text = c;
+        }
+        else if (c == '"')
+        {
+            if (in_phrase)
+                finish_phrase(tokens, stopwords, dictionary);
+            in_phrase = !in_phrase;
         }
     }
+}
 
+// Query preprocessing function for Task 4.2: the lexer's tokens as strings
+vector<string> preprocess_query(const string &title, const WordTable &stopwords)
+{
+    QueryTokens tokens;
+    lex_query(title, stopwords, nullptr, tokens);
+
+    vector<string> result;
+    for (size_t i = 0; i < tokens.count; i++)
+    {
+        result.push_back(tokens[i].text);
+    }
     return result;
 }
 
@@ -335,46 +693,62 @@ vector<string> infix_to_postfix(const vector<string> &tokens);
 QueryNode *build_tree(const vector<string> &postfix);
 vector<string> evaluate_tree(QueryNode *root, const map<string, map<string, vector<uint32_t>>> &index);
 
-// Main decompression function
-map<string, map<string, vector<uint32_t>>> decompress_index(const string &compressed_dir)
+// Compute document lengths and score bounds from the postings themselves
+// (index built before bm25.bin existed, or built in memory)
+void compute_ranking_stats(SearchIndex &index)
 {
-    map<string, map<string, vector<uint32_t>>> index;
-
-    // Load doc_map.json
-    ifstream doc_map_file(compressed_dir + "/doc_map.json");
-    if (!doc_map_file.is_open())
+    RankingStats &stats = index.ranking;
+    stats = RankingStats();
+    stats.doc_lengths.assign(index.doc_names.size(), 0);
+    for (const auto &entry : index.postings.terms)
     {
-        cerr << "Error: Cannot open " << compressed_dir << "/doc_map.json" << endl;
-        return index;
+        for (PostingCursor cursor(index.postings, entry.second); !cursor.at_end(); cursor.next())
+        {
+            if (cursor.doc_id < stats.doc_lengths.size())
+                stats.doc_lengths[cursor.doc_id] += cursor.tf;
+        }
     }
-    string doc_map_content((istreambuf_iterator<char>(doc_map_file)), istreambuf_iterator<char>());
-    doc_map_file.close();
-    vector<string> doc_map = parse_doc_map(doc_map_content);
+    finish_ranking_stats(stats);
 
-    // Initialize global_all_docs
-    global_all_docs = doc_map;
-    sort(global_all_docs.begin(), global_all_docs.end());
+    index.score_bounds.clear();
+    vector<pair<uint32_t, uint32_t>> postings;
+    for (const auto &entry : index.postings.terms)
+    {
+        postings.clear();
+        for (PostingCursor cursor(index.postings, entry.second); !cursor.at_end(); cursor.next())
+        {
+            postings.push_back(make_pair(cursor.doc_id, cursor.tf));
+        }
+        index.score_bounds[entry.first] = compute_score_bounds(postings, postings.size(), stats);
+    }
+}
 
-    // Load metadata.json
-    ifstream metadata_file(compressed_dir + "/metadata.json");
-    if (!metadata_file.is_open())
+// Load bm25.bin written by build_index, falling back to computing it
+void load_ranking_stats(const string &path, SearchIndex &index)
+{
+    vector<TermScoreBounds> bounds;
+    if (!read_ranking_file(path, index.ranking, bounds) || bounds.size() != index.postings.terms.size() ||
+        index.ranking.doc_lengths.size() != index.doc_names.size())
     {
-        cerr << "Error: Cannot open " << compressed_dir << "/metadata.json" << endl;
-        return index;
+        compute_ranking_stats(index);
+        return;
     }
-    string metadata_content((istreambuf_iterator<char>(metadata_file)), istreambuf_iterator<char>());
-    metadata_file.close();
-    map<string, pair<size_t, size_t>> metadata = parse_metadata(metadata_content);
 
-    // Load postings.bin
-    ifstream postings_file(compressed_dir + "/postings.bin", ios::binary);
-    if (!postings_file.is_open())
+    // Bounds are stored in sorted term order, the dictionary's iteration order
+    size_t i = 0;
+    for (const auto &entry : index.postings.terms)
     {
-        cerr << "Error: Cannot open " << compressed_dir << "/postings.bin" << endl;
-        return index;
+        index.score_bounds[entry.first] = move(bounds[i++]);
     }
-    vector<uint8_t> postings_data((istreambuf_iterator<char>(postings_file)), istreambuf_iterator<char>());
-    postings_file.close();
+}
+
+// Decode every posting list of postings.bin (positions included), doc IDs
+// mapped to document names
+map<string, map<string, vector<uint32_t>>> decode_postings(const vector<uint8_t> &postings_data,
+                                                           const map<string, pair<size_t, size_t>> &metadata,
+                                                           const vector<string> &doc_map)
+{
+    map<string, map<string, vector<uint32_t>>> index;
 
     // Decompress each term
     for (const auto &term_meta : metadata)
@@ -425,8 +799,12 @@ map<string, map<string, vector<uint32_t>>> decompress_index(const string &compre
             index[term][doc_name] = positions;
         }
     }
+    return index;
+}
 
-    // Write decompressed_index.json to compressed_dir
+// Write a decoded index to compressed_dir/decompressed_index.json
+void write_decompressed_index(map<string, map<string, vector<uint32_t>>> &index, const string &compressed_dir)
+{
     ofstream out(compressed_dir + "/decompressed_index.json");
     if (out.is_open())
     {
@@ -479,13 +857,165 @@ map<string, map<string, vector<uint32_t>>> decompress_index(const string &compre
         out << "}\n";
         out.close();
     }
+}
+
+// Load the search structures of one index directory into search_index;
+// false if a required file is missing. If decoded is given, the postings are
+// also decompressed into it and written to decompressed_index.json (a single
+// index: shards keep only their compressed postings).
+bool load_index_directory(const string &compressed_dir, SearchIndex &search_index,
+                          map<string, map<string, vector<uint32_t>>> *decoded)
+{
+    // Load doc_map.json
+    ifstream doc_map_file(compressed_dir + "/doc_map.json");
+    if (!doc_map_file.is_open())
+    {
+        cerr << "Error: Cannot open " << compressed_dir << "/doc_map.json" << endl;
+        return false;
+    }
+    string doc_map_content((istreambuf_iterator<char>(doc_map_file)), istreambuf_iterator<char>());
+    doc_map_file.close();
+    vector<string> doc_map = parse_doc_map(doc_map_content);
+
+    // Load metadata.json
+    ifstream metadata_file(compressed_dir + "/metadata.json");
+    if (!metadata_file.is_open())
+    {
+        cerr << "Error: Cannot open " << compressed_dir << "/metadata.json" << endl;
+        return false;
+    }
+    string metadata_content((istreambuf_iterator<char>(metadata_file)), istreambuf_iterator<char>());
+    metadata_file.close();
+    map<string, pair<size_t, size_t>> metadata = parse_metadata(metadata_content);
+
+    // Load postings.bin
+    ifstream postings_file(compressed_dir + "/postings.bin", ios::binary);
+    if (!postings_file.is_open())
+    {
+        cerr << "Error: Cannot open " << compressed_dir << "/postings.bin" << endl;
+        return false;
+    }
+    vector<uint8_t> postings_data((istreambuf_iterator<char>(postings_file)), istreambuf_iterator<char>());
+    postings_file.close();
+
+    if (decoded)
+    {
+        *decoded = decode_postings(postings_data, metadata, doc_map);
+        write_decompressed_index(*decoded, compressed_dir);
+    }
+
+    // Keep the compressed postings for skip-aware query evaluation
+    search_index.doc_names = doc_map;
+    search_index.names_sorted = is_sorted(doc_map.begin(), doc_map.end());
+    load_compressed_postings(search_index.postings, move(postings_data), metadata);
+    build_term_list(search_index);
+
+    // Permuterm index for suffix / infix wildcards (ignored if stale)
+    if (!read_permuterm_file(compressed_dir + "/permuterm.bin", search_index.term_list.size(),
+                             search_index.permuterm))
+    {
+        search_index.permuterm.clear();
+    }
+
+    // Analyzer the index was built with, so queries drop the same stopwords
+    search_index.has_analyzer =
+        read_analyzer_file(compressed_dir + "/analyzer.bin", search_index.analyzer);
+
+    // Optional bi-word index (built with --biword-min-df / --biword-queries)
+    ifstream biword_metadata_file(compressed_dir + "/biword_metadata.json");
+    ifstream biword_postings_file(compressed_dir + "/biword_postings.bin", ios::binary);
+    if (biword_metadata_file.is_open() && biword_postings_file.is_open())
+    {
+        string biword_metadata((istreambuf_iterator<char>(biword_metadata_file)), istreambuf_iterator<char>());
+        vector<uint8_t> biword_data((istreambuf_iterator<char>(biword_postings_file)), istreambuf_iterator<char>());
+        load_compressed_postings(search_index.biwords, move(biword_data), parse_metadata(biword_metadata));
+    }
+
+    // BM25 statistics, only needed in ranked mode
+    if (global_options.ranked)
+    {
+        load_ranking_stats(compressed_dir + "/bm25.bin", search_index);
+    }
+
+    return true;
+}
+
+// Main decompression function: a single index, decoded into the returned
+// map, or the shards of a sharded one (listed in shards.json) loaded into
+// global_shards on a thread pool. Shards are not decoded (the map stays
+// empty); the global search index holds only the merged name table and the
+// analyzer.
+map<string, map<string, vector<uint32_t>>> decompress_index(const string &compressed_dir)
+{
+    map<string, map<string, vector<uint32_t>>> index;
+    uint32_t shard_count = 0;
+    if (!read_shard_count(compressed_dir, shard_count))
+    {
+        cerr << "Error: Damaged or unsupported shard manifest: " << compressed_dir << "/" << SHARD_MANIFEST
+             << " (1 to " << MAX_SHARDS << " shards)" << endl;
+        return index;
+    }
+    if (shard_count == 0)
+    {
+        if (load_index_directory(compressed_dir, global_search_index, &index))
+        {
+            global_all_docs = global_search_index.doc_names;
+            sort(global_all_docs.begin(), global_all_docs.end());
+        }
+        return index;
+    }
+
+    global_shards.assign(shard_count, SearchIndex());
+    vector<char> loaded(shard_count, 0);
+    WorkStealingPool pool(min(resolve_thread_count(0), shard_count));
+    pool.start(shard_count, [&](size_t k)
+               {
+                   global_shards[k].shard = k;
+                   loaded[k] = load_index_directory(shard_directory(compressed_dir, k), global_shards[k], nullptr);
+               });
+    pool.wait();
+    if (find(loaded.begin(), loaded.end(), 0) != loaded.end())
+    {
+        // A missing shard would silently drop its documents from every result
+        cerr << "Error: Cannot load every shard of " << compressed_dir << endl;
+        global_shards.clear();
+        return index;
+    }
+
+    vector<string> names;
+    bool has_analyzer = true;
+    for (const SearchIndex &shard : global_shards)
+    {
+        names.insert(names.end(), shard.doc_names.begin(), shard.doc_names.end());
+        has_analyzer = has_analyzer && shard.has_analyzer;
+    }
 
+    // Merged name table: results of all shards map into one sorted doc ID space
+    sort(names.begin(), names.end());
+    for (SearchIndex &shard : global_shards)
+    {
+        shard.merged_doc_ids.clear();
+        for (const string &name : shard.doc_names)
+        {
+            shard.merged_doc_ids.push_back(lower_bound(names.begin(), names.end(), name) - names.begin());
+        }
+    }
+    global_all_docs = names;
+    global_search_index.doc_names = move(names);
+    global_search_index.names_sorted = true;
+    global_search_index.has_analyzer = has_analyzer;
+    global_search_index.analyzer = global_shards[0].analyzer;
+
+    status_stream() << "Loaded " << shard_count << " shards with " << global_search_index.doc_names.size()
+                    << " documents." << endl;
     return index;
 }
 
 // get_precedence function
 int get_precedence(const string &op)
 {
+    if (is_near_operator(op))
+        return 4;
     if (op == "NOT")
         return 3;
     if (op == "AND")
@@ -550,146 +1080,1752 @@ vector<string> infix_to_postfix(const vector<string> &tokens)
     return postfix;
 }
 
-// build_tree function
-QueryNode *build_tree(const vector<string> &postfix)
+// Arena of the query trees built on this thread
+QueryArena &query_arena()
 {
-    stack<QueryNode *> node_stack;
+    static thread_local QueryArena arena;
+    return arena;
+}
 
-    for (const auto &token : postfix)
+// Link a new node into the tree being built: operators pop one (NOT) or two
+// (AND, OR, NEAR/k) operands, anything else is a leaf; false if operands are missing
+bool push_tree_node(QueryNode *node, vector<QueryNode *> &node_stack)
+{
+    if (is_operator_token(node->type))
+    {
+        size_t arity = node->type == TOKEN_NOT ? 1 : 2;
+        if (node_stack.size() < arity)
+            return false; // Error: operator without enough operands
+        node->right = node_stack.back();
+        node_stack.pop_back();
+        if (arity == 2)
+        {
+            node->left = node_stack.back();
+            node_stack.pop_back();
+        }
+    }
+    node_stack.push_back(node);
+    return true;
+}
+
+// build_tree function: the tree lives in this thread's query arena until the
+// next tree is built on the same thread (nothing to delete)
+QueryNode *build_tree(const vector<string> &postfix)
+{
+    QueryArena &arena = query_arena();
+    arena.reset(postfix.size()); // Every postfix token becomes exactly one node
+    for (const auto &token : postfix)
+    {
+        if (!push_tree_node(arena.make(token, classify_token(token)), arena.stack))
+            return nullptr;
+    }
+
+    // Should have exactly one node left (the root); anything else is malformed
+    return arena.stack.size() == 1 ? arena.stack.back() : nullptr;
+}
+
+// Operator precedence of a token type (0 for operands and parentheses)
+int token_precedence(QueryTokenType type)
+{
+    switch (type)
+    {
+    case TOKEN_NEAR:
+        return 4;
+    case TOKEN_NOT:
+        return 3;
+    case TOKEN_AND:
+        return 2;
+    case TOKEN_OR:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Shunting-yard pass over typed tokens, recording token indices in postfix
+// order (same rules as infix_to_postfix: NOT is right-associative, an
+// unmatched "(" ends up in the output and so fails to parse)
+void postfix_order(const QueryTokens &tokens, vector<uint32_t> &postfix, vector<uint32_t> &operators)
+{
+    postfix.clear();
+    operators.clear();
+    for (uint32_t i = 0; i < tokens.count; i++)
+    {
+        QueryTokenType type = tokens[i].type;
+        if (is_operand_token(type))
+        {
+            postfix.push_back(i);
+        }
+        else if (type == TOKEN_LPAREN)
+        {
+            operators.push_back(i);
+        }
+        else if (type == TOKEN_RPAREN)
+        {
+            while (!operators.empty() && tokens[operators.back()].type != TOKEN_LPAREN)
+            {
+                postfix.push_back(operators.back());
+                operators.pop_back();
+            }
+            if (!operators.empty())
+                operators.pop_back(); // Remove "("
+        }
+        else
+        {
+            int precedence = token_precedence(type);
+            while (!operators.empty() && tokens[operators.back()].type != TOKEN_LPAREN)
+            {
+                int top = token_precedence(tokens[operators.back()].type);
+                if (type == TOKEN_NOT ? top <= precedence : top < precedence)
+                    break;
+                postfix.push_back(operators.back());
+                operators.pop_back();
+            }
+            operators.push_back(i);
+        }
+    }
+
+    while (!operators.empty())
+    {
+        postfix.push_back(operators.back());
+        operators.pop_back();
+    }
+}
+
+// Build the AST of lexed tokens in this thread's query arena (nullptr if malformed)
+QueryNode *build_tree(const QueryTokens &tokens)
+{
+    QueryArena &arena = query_arena();
+    postfix_order(tokens, arena.postfix, arena.operators);
+    arena.reset(arena.postfix.size());
+    for (uint32_t i : arena.postfix)
+    {
+        QueryNode *node = arena.make(tokens[i].text, tokens[i].type);
+        node->postings = tokens[i].postings;
+        node->resolved = tokens[i].resolved;
+        if (!push_tree_node(node, arena.stack))
+            return nullptr;
+    }
+    return arena.stack.size() == 1 ? arena.stack.back() : nullptr;
+}
+
+// Intermediate result of a Boolean subexpression. A complemented set stands
+// for "every document except docs", so NOT only flips a flag instead of
+// copying the whole collection; A AND NOT B then becomes a direct difference.
+struct ResultSet
+{
+    DocList docs; // Sorted doc IDs
+    bool complemented;
+
+    ResultSet() : complemented(false) {}
+};
+
+// Combine a lazily complemented operand into left (AND if conjunction, else
+// OR), through the caller's scratch buffer; cost is linear in the operands only
+void combine_results(bool conjunction, ResultSet &left, const ResultSet &right, DocList &buffer)
+{
+    ResultSet result;
+    result.docs.swap(buffer);
+    result.docs.clear();
+    const DocList &l = left.docs;
+    const DocList &r = right.docs;
+
+    if (conjunction)
+    {
+        if (!left.complemented && !right.complemented)
+        {
+            intersect_lists(l.data(), l.size(), r.data(), r.size(), result.docs);
+        }
+        else if (!left.complemented)
+        {
+            // A AND NOT B = A - B
+            difference_lists(l.data(), l.size(), r.data(), r.size(), result.docs);
+        }
+        else if (!right.complemented)
+        {
+            // NOT A AND B = B - A
+            difference_lists(r.data(), r.size(), l.data(), l.size(), result.docs);
+        }
+        else
+        {
+            // NOT A AND NOT B = NOT (A OR B)
+            union_lists(l.data(), l.size(), r.data(), r.size(), result.docs);
+            result.complemented = true;
+        }
+    }
+    else
+    {
+        if (!left.complemented && !right.complemented)
+        {
+            union_lists(l.data(), l.size(), r.data(), r.size(), result.docs);
+        }
+        else if (!left.complemented)
+        {
+            // A OR NOT B = NOT (B - A)
+            difference_lists(r.data(), r.size(), l.data(), l.size(), result.docs);
+            result.complemented = true;
+        }
+        else if (!right.complemented)
+        {
+            // NOT A OR B = NOT (A - B)
+            difference_lists(l.data(), l.size(), r.data(), r.size(), result.docs);
+            result.complemented = true;
+        }
+        else
+        {
+            // NOT A OR NOT B = NOT (A AND B)
+            intersect_lists(l.data(), l.size(), r.data(), r.size(), result.docs);
+            result.complemented = true;
+        }
+    }
+
+    // The old list becomes the next scratch buffer
+    left.docs.swap(result.docs);
+    left.complemented = result.complemented;
+    buffer.swap(result.docs);
+}
+
+// Turn a lazy result into a plain sorted list; only here is the universe
+// (every doc ID in range) enumerated
+DocList materialize_result(ResultSet &result, DocRange range)
+{
+    if (!result.complemented)
+    {
+        return move(result.docs);
+    }
+
+    DocList docs;
+    size_t next_excluded = 0;
+    for (uint32_t doc_id = range.begin; doc_id < range.end; doc_id++)
+    {
+        if (next_excluded < result.docs.size() && result.docs[next_excluded] == doc_id)
+        {
+            next_excluded++;
+            continue;
+        }
+        docs.push_back(doc_id);
+    }
+    return docs;
+}
+
+// Node types of an optimized query plan
+enum PlanOp
+{
+    PLAN_TERM,   // Posting list of a single term
+    PLAN_BIWORD, // Posting list of an adjacent term pair from the bi-word index
+    PLAN_AND,    // n-ary intersection, rarest operand first
+    PLAN_OR,     // n-ary union
+    PLAN_NOT,    // Complement of its only child
+    PLAN_PHRASE, // Term children at consecutive positions
+    PLAN_NEAR,   // Two positional children at most window positions apart
+    PLAN_EMPTY   // Known-empty result (out-of-vocabulary term)
+};
+
+// Optimized query plan node (n-ary, annotated with estimated cardinality)
+struct PlanNode
+{
+    PlanOp op;
+    string term;              // Only for PLAN_TERM and PLAN_BIWORD
+    uint32_t window;          // Only for PLAN_NEAR
+    uint32_t offset;          // Only for phrase children: position relative to the phrase start
+    size_t estimate;          // Estimated number of matching documents
+    vector<PlanNode> children;
+
+    PlanNode(PlanOp o = PLAN_EMPTY) : op(o), window(0), offset(0), estimate(0) {}
+};
+
+// Dictionary a leaf's posting list lives in
+const CompressedPostings &leaf_source(const PlanNode &node, const SearchIndex &index)
+{
+    return node.op == PLAN_BIWORD ? index.biwords : index.postings;
+}
+
+// Posting list of a TERM or BIWORD leaf (nullptr for other nodes)
+const TermPostings *leaf_postings(const PlanNode &node, const SearchIndex &index)
+{
+    if (node.op != PLAN_TERM && node.op != PLAN_BIWORD)
+        return nullptr;
+    return find_term(leaf_source(node, index), node.term);
+}
+
+// Wrap a plan node in NOT, cancelling double negation
+PlanNode negate_plan(PlanNode node, size_t universe_size)
+{
+    if (node.op == PLAN_NOT)
+    {
+        PlanNode child = move(node.children[0]);
+        return child;
+    }
+    PlanNode result(PLAN_NOT);
+    result.estimate = universe_size - min(node.estimate, universe_size);
+    result.children.push_back(move(node));
+    return result;
+}
+
+// True for NOT(EMPTY), i.e. the whole collection
+bool is_universe_plan(const PlanNode &node)
+{
+    return node.op == PLAN_NOT && node.children[0].op == PLAN_EMPTY;
+}
+
+// Order operands by ascending estimate (terms tie-broken by name so duplicates are adjacent)
+bool plan_cheaper(const PlanNode &a, const PlanNode &b)
+{
+    if (a.estimate != b.estimate)
+        return a.estimate < b.estimate;
+    if (a.op != b.op)
+        return a.op < b.op;
+    return a.term < b.term;
+}
+
+// Drop repeated term operands (x AND x = x OR x = x)
+void remove_duplicate_terms(vector<PlanNode> &children)
+{
+    vector<PlanNode> unique_children;
+    for (auto &child : children)
+    {
+        if ((child.op == PLAN_TERM || child.op == PLAN_BIWORD) && !unique_children.empty() &&
+            unique_children.back().op == child.op && unique_children.back().term == child.term)
+        {
+            continue;
+        }
+        unique_children.push_back(move(child));
+    }
+    children.swap(unique_children);
+}
+
+PlanNode normalize_or(vector<PlanNode> children, size_t universe_size);
+
+// Simplify a flattened conjunction: short-circuit on empty operands, order
+// positive operands by ascending DF and keep negated ones as differences
+PlanNode normalize_and(vector<PlanNode> children, size_t universe_size)
+{
+    vector<PlanNode> positives, negatives;
+    for (auto &child : children)
+    {
+        if (child.op == PLAN_EMPTY)
+        {
+            return PlanNode(PLAN_EMPTY); // Out-of-vocabulary conjunct
+        }
+        if (is_universe_plan(child))
+        {
+            continue; // x AND ALL = x
+        }
+        if (child.op == PLAN_NOT)
+            negatives.push_back(move(child));
+        else
+            positives.push_back(move(child));
+    }
+
+    if (positives.empty() && negatives.empty())
+    {
+        return negate_plan(PlanNode(PLAN_EMPTY), universe_size);
+    }
+
+    if (positives.empty() && negatives.size() > 1)
+    {
+        // De Morgan: NOT a AND NOT b = NOT (a OR b), one union instead of a complement chain
+        vector<PlanNode> operands;
+        for (auto &negative : negatives)
+        {
+            operands.push_back(move(negative.children[0]));
+        }
+        return negate_plan(normalize_or(move(operands), universe_size), universe_size);
+    }
+
+    sort(positives.begin(), positives.end(), plan_cheaper);
+    remove_duplicate_terms(positives);
+    sort(negatives.begin(), negatives.end(), plan_cheaper);
+
+    PlanNode result(PLAN_AND);
+    result.estimate = positives.empty() ? negatives[0].estimate : positives[0].estimate;
+    for (auto &positive : positives)
+    {
+        result.children.push_back(move(positive));
+    }
+    for (auto &negative : negatives)
+    {
+        result.children.push_back(move(negative));
+    }
+
+    if (result.children.size() == 1)
+    {
+        PlanNode only = move(result.children[0]);
+        return only;
+    }
+    return result;
+}
+
+// Simplify a flattened disjunction: drop empty operands and push negated
+// operands into a single difference via De Morgan
+PlanNode normalize_or(vector<PlanNode> children, size_t universe_size)
+{
+    vector<PlanNode> positives, negatives;
+    for (auto &child : children)
+    {
+        if (child.op == PLAN_EMPTY)
+        {
+            continue; // x OR EMPTY = x
+        }
+        if (is_universe_plan(child))
+        {
+            return negate_plan(PlanNode(PLAN_EMPTY), universe_size);
+        }
+        if (child.op == PLAN_NOT)
+            negatives.push_back(move(child));
+        else
+            positives.push_back(move(child));
+    }
+
+    if (!negatives.empty())
+    {
+        // De Morgan: p OR NOT a OR NOT b = NOT (a AND b AND NOT p)
+        vector<PlanNode> operands;
+        for (auto &negative : negatives)
+        {
+            operands.push_back(move(negative.children[0]));
+        }
+        for (auto &positive : positives)
+        {
+            operands.push_back(negate_plan(move(positive), universe_size));
+        }
+        return negate_plan(normalize_and(move(operands), universe_size), universe_size);
+    }
+
+    if (positives.empty())
+    {
+        return PlanNode(PLAN_EMPTY);
+    }
+
+    sort(positives.begin(), positives.end(), plan_cheaper);
+    remove_duplicate_terms(positives);
+
+    if (positives.size() == 1)
+    {
+        PlanNode only = move(positives[0]);
+        return only;
+    }
+
+    PlanNode result(PLAN_OR);
+    for (auto &positive : positives)
+    {
+        result.estimate += positive.estimate;
+        result.children.push_back(move(positive));
+    }
+    result.estimate = min(result.estimate, universe_size);
+    return result;
+}
+
+// True if a plan yields token positions: terms, phrases, NEAR and unions of those
+bool is_positional_plan(const PlanNode &node)
+{
+    if (node.op == PLAN_TERM || node.op == PLAN_BIWORD || node.op == PLAN_PHRASE || node.op == PLAN_NEAR)
+        return true;
+    if (node.op != PLAN_OR)
+        return false;
+    for (const auto &child : node.children)
+    {
+        if (!is_positional_plan(child))
+            return false;
+    }
+    return true;
+}
+
+// Plan leaf for a single dictionary term given its dictionary entry (EMPTY
+// if out of vocabulary)
+PlanNode term_plan(const string &term, const TermPostings *postings)
+{
+    if (!postings || postings->doc_count == 0)
+    {
+        return PlanNode(PLAN_EMPTY);
+    }
+    PlanNode leaf(PLAN_TERM);
+    leaf.term = term;
+    leaf.estimate = postings->doc_count;
+    return leaf;
+}
+
+// Plan for a phrase token; any out-of-vocabulary term empties the phrase.
+// Adjacent pairs found in the bi-word index replace two term lists (and
+// their long position lists) by one short list; a fully covered two-term
+// phrase needs no positions at all.
+PlanNode phrase_plan(const string &phrase, const SearchIndex &index)
+{
+    vector<PlanNode> terms;
+    istringstream words(phrase);
+    string word;
+    while (words >> word)
+    {
+        PlanNode leaf = term_plan(word, find_term(index.postings, word));
+        if (leaf.op == PLAN_EMPTY)
+            return leaf;
+        terms.push_back(move(leaf));
+    }
+
+    PlanNode result(PLAN_PHRASE);
+    result.estimate = SIZE_MAX;
+    for (size_t i = 0; i < terms.size();)
+    {
+        PlanNode unit = move(terms[i]);
+        unit.offset = i++;
+        const TermPostings *biword = nullptr;
+        if (i < terms.size() && !index.biwords.terms.empty())
+            biword = find_term(index.biwords, unit.term + " " + terms[i].term);
+        if (biword)
+        {
+            if (biword->doc_count == 0)
+                return PlanNode(PLAN_EMPTY);
+            unit.op = PLAN_BIWORD;
+            unit.term += " " + terms[i++].term;
+            unit.estimate = biword->doc_count;
+        }
+        result.estimate = min(result.estimate, unit.estimate);
+        result.children.push_back(move(unit));
+    }
+
+    if (result.children.size() == 1)
+    {
+        PlanNode only = move(result.children[0]);
+        return only;
+    }
+    return result;
+}
+
+// Plan for a wildcard term: every matching dictionary term as one n-ary OR,
+// which compiles to a single multi-way union (EMPTY if nothing matches)
+PlanNode wildcard_plan(const string &pattern, const SearchIndex &index)
+{
+    vector<uint32_t> matches;
+    expand_wildcard(pattern, index.term_list, index.permuterm, matches);
+
+    vector<PlanNode> children;
+    for (uint32_t t : matches)
+    {
+        children.push_back(term_plan(*index.term_list[t], index.term_entries[t]));
+    }
+    return normalize_or(move(children), index.doc_names.size());
+}
+
+// Collect the operands of a chain of identical binary operators
+void flatten_operands(QueryNode *node, QueryTokenType op, vector<QueryNode *> &operands)
+{
+    if (node && node->type == op)
+    {
+        flatten_operands(node->left, op, operands);
+        flatten_operands(node->right, op, operands);
+    }
+    else
+    {
+        operands.push_back(node);
+    }
+}
+
+// Cost-based optimization pass: turn a binary parse tree into an n-ary plan
+// with DF estimates from the dictionary
+PlanNode optimize_query(QueryNode *root, const SearchIndex &index)
+{
+    size_t universe_size = index.doc_names.size();
+    if (!root)
+        return PlanNode(PLAN_EMPTY);
+
+    if (!is_operator_token(root->type))
+    {
+        if (root->type == TOKEN_WILDCARD)
+            return wildcard_plan(root->value, index);
+        if (is_phrase(root->value))
+            return phrase_plan(root->value, index);
+        if (root->resolved)
+            return term_plan(root->value, root->postings);
+        return term_plan(root->value, find_term(index.postings, root->value));
+    }
+
+    if (root->type == TOKEN_NOT)
+    {
+        return negate_plan(optimize_query(root->right, index), universe_size);
+    }
+
+    if (root->type == TOKEN_NEAR)
+    {
+        vector<PlanNode> children;
+        children.push_back(optimize_query(root->left, index));
+        children.push_back(optimize_query(root->right, index));
+        if (!is_positional_plan(children[0]) || !is_positional_plan(children[1]))
+        {
+            // Operands without positions (EMPTY, NOT, AND) make NEAR a plain AND
+            return normalize_and(move(children), universe_size);
+        }
+        PlanNode near(PLAN_NEAR);
+        near.window = near_window(root->value);
+        near.estimate = min(children[0].estimate, children[1].estimate);
+        near.children = move(children);
+        return near;
+    }
+
+    vector<QueryNode *> operands;
+    flatten_operands(root, root->type, operands);
+
+    vector<PlanNode> children;
+    for (QueryNode *operand : operands)
+    {
+        children.push_back(optimize_query(operand, index));
+    }
+
+    if (root->type == TOKEN_AND)
+        return normalize_and(move(children), universe_size);
+    return normalize_or(move(children), universe_size);
+}
+
+ResultSet evaluate_plan(const PlanNode &node, const SearchIndex &index, DocRange range);
+
+// Doc-level relaxation of a positional plan: phrases and NEAR become ANDs of
+// their operands, so candidates are found without touching positions
+PlanNode relax_positional(const PlanNode &node, size_t universe_size)
+{
+    if (node.op == PLAN_TERM || node.op == PLAN_BIWORD)
+        return node;
+
+    vector<PlanNode> children;
+    for (const auto &child : node.children)
+    {
+        children.push_back(relax_positional(child, universe_size));
+    }
+    if (node.op == PLAN_OR)
+        return normalize_or(move(children), universe_size);
+    return normalize_and(move(children), universe_size);
+}
+
+// Positional matcher compiled from a plan; every term or bi-word leaf owns a cursor
+struct SpanMatcher
+{
+    PlanOp op;
+    uint32_t window;
+    uint32_t offset; // Position relative to the enclosing phrase start
+    size_t cursor;   // Only for leaves
+    vector<SpanMatcher> children;
+};
+
+SpanMatcher compile_span_matcher(const PlanNode &node, const SearchIndex &index, vector<PostingCursor> &cursors)
+{
+    SpanMatcher matcher;
+    matcher.op = node.op;
+    matcher.window = node.window;
+    matcher.offset = node.offset;
+    matcher.cursor = cursors.size();
+    if (const TermPostings *postings = leaf_postings(node, index))
+    {
+        cursors.push_back(PostingCursor(leaf_source(node, index), *postings));
+    }
+    for (const auto &child : node.children)
+    {
+        matcher.children.push_back(compile_span_matcher(child, index, cursors));
+    }
+    return matcher;
+}
+
+// Decode the positions of a term leaf in doc_id (false if it does not occur)
+bool term_positions(const SpanMatcher &matcher, uint32_t doc_id, vector<PostingCursor> &cursors,
+                    vector<uint32_t> &positions)
+{
+    PostingCursor &cursor = cursors[matcher.cursor];
+    cursor.advance(doc_id);
+    if (cursor.at_end() || cursor.doc_id != doc_id)
+        return false;
+    cursor.positions(positions);
+    return true;
+}
+
+// Spans matched by a positional plan in one document (doc IDs must be
+// visited in ascending order); returns false if there are none
+bool match_spans(const SpanMatcher &matcher, uint32_t doc_id, vector<PostingCursor> &cursors,
+                 vector<PositionSpan> &out)
+{
+    out.clear();
+    vector<uint32_t> positions;
+    switch (matcher.op)
+    {
+    case PLAN_TERM:
+    case PLAN_BIWORD:
+    {
+        // A bi-word occurrence covers its start position and the next one
+        uint32_t extent = matcher.op == PLAN_BIWORD ? 1 : 0;
+        if (term_positions(matcher, doc_id, cursors, positions))
+        {
+            for (uint32_t position : positions)
+            {
+                out.push_back(PositionSpan(position, position + extent));
+            }
+        }
+        break;
+    }
+    case PLAN_PHRASE:
+    {
+        // Each unit (term or bi-word) must sit at its offset from the start
+        vector<uint32_t> starts;
+        if (!term_positions(matcher.children[0], doc_id, cursors, starts))
+            return false;
+        for (size_t i = 1; i < matcher.children.size() && !starts.empty(); i++)
+        {
+            if (!term_positions(matcher.children[i], doc_id, cursors, positions))
+                return false;
+            extend_phrase(starts, positions, matcher.children[i].offset);
+        }
+        const SpanMatcher &last = matcher.children.back();
+        uint32_t length = last.offset + (last.op == PLAN_BIWORD ? 1 : 0);
+        for (uint32_t start : starts)
+        {
+            out.push_back(PositionSpan(start, start + length));
+        }
+        break;
+    }
+    case PLAN_NEAR:
+    {
+        vector<PositionSpan> left, right;
+        if (match_spans(matcher.children[0], doc_id, cursors, left) &&
+            match_spans(matcher.children[1], doc_id, cursors, right))
+        {
+            join_near_spans(left, right, matcher.window, out);
+        }
+        break;
+    }
+    case PLAN_OR:
+    {
+        vector<PositionSpan> child_spans;
+        for (const auto &child : matcher.children)
+        {
+            match_spans(child, doc_id, cursors, child_spans);
+            out.insert(out.end(), child_spans.begin(), child_spans.end());
+        }
+        sort(out.begin(), out.end());
+        out.erase(unique(out.begin(), out.end()), out.end());
+        break;
+    }
+    default:
+        break;
+    }
+    return !out.empty();
+}
+
+// Phrase / NEAR evaluation: a doc-level AND (optionally narrowed by the
+// enclosing conjunction's candidates) picks the documents, and positions
+// are decoded only for those. Positions are in stopword-free token space on
+// both sides, so removed stopwords never open gaps inside a phrase.
+ResultSet evaluate_positional(const PlanNode &node, const SearchIndex &index, DocRange range,
+                              const DocList *candidates = nullptr)
+{
+    ResultSet relaxed = evaluate_plan(relax_positional(node, index.doc_names.size()), index, range);
+    DocList docs;
+    if (candidates)
+        intersect_lists(relaxed.docs.data(), relaxed.docs.size(), candidates->data(), candidates->size(), docs);
+    else
+        docs.swap(relaxed.docs);
+
+    vector<PostingCursor> cursors;
+    SpanMatcher matcher = compile_span_matcher(node, index, cursors);
+    vector<PositionSpan> spans;
+    ResultSet result;
+    for (uint32_t doc_id : docs)
+    {
+        if (match_spans(matcher, doc_id, cursors, spans))
+            result.docs.push_back(doc_id);
+    }
+    for (const auto &cursor : cursors)
+    {
+        cursor.count_scanned();
+    }
+    return result;
+}
+
+// Instructions of a compiled plan. A plan compiles to a flat postfix program
+// run on a stack of result sets; term operands are listed in the plan's
+// operand table, and an AND that runs empty jumps over its remaining operands.
+enum PlanOpcode
+{
+    OP_TERM,              // Push the doc IDs of operand first
+    OP_EMPTY,             // Push an empty set
+    OP_NOT,               // Complement the top
+    OP_AND_TERMS,         // Push the intersection of operands [first, first + count)
+    OP_AND,               // Pop the top and intersect it into the new top
+    OP_EXIT_IF_EMPTY,     // Jump to target if the top is a plain empty set
+    OP_SUBTRACT_TERMS,    // Remove operands [first, first + count) from the top
+    OP_OR,                // Pop sets results, push their union with operands [first, first + count)
+    OP_POSITIONAL,        // Push the matches of a phrase / NEAR node
+    OP_FILTER_POSITIONAL  // Narrow the top to the matches of a phrase / NEAR node
+};
+
+struct PlanInstr
+{
+    PlanOpcode opcode;
+    uint32_t first;       // First term operand
+    uint32_t count;       // Number of term operands
+    uint32_t sets;        // OP_OR: number of computed sets on the stack
+    uint32_t target;      // OP_EXIT_IF_EMPTY: instruction to continue at
+    const PlanNode *node; // Positional instructions
+
+    PlanInstr(PlanOpcode op, uint32_t f = 0, uint32_t c = 0)
+        : opcode(op), first(f), count(c), sets(0), target(0), node(nullptr) {}
+};
+
+// Instructions [begin, end) compiled from one plan node
+struct PlanSpan
+{
+    const PlanNode *node;
+    uint32_t begin;
+    uint32_t end;
+};
+
+// Flat program compiled from an optimized plan (refers to the plan's nodes
+// for positional operands, so the plan must outlive it)
+struct CompiledPlan
+{
+    vector<PlanInstr> code;
+    vector<pair<const CompressedPostings *, const TermPostings *>> terms; // Operand table
+    vector<PlanSpan> spans; // Code of each compiled plan node, children first
+
+    void clear()
+    {
+        code.clear();
+        terms.clear();
+        spans.clear();
+    }
+};
+
+// Actual costs of one plan node, recorded by a profiled run
+struct NodeProfile
+{
+    size_t output;        // Documents produced (complements counted against the range)
+    size_t bytes_decoded; // Compressed posting bytes scanned, operands included
+    double millis;        // Wall time, operands included
+
+    NodeProfile() : output(0), bytes_decoded(0), millis(0) {}
+};
+
+// Collects NodeProfiles while run_plan executes: a node starts when the
+// first instruction of its span runs and ends when execution reaches the end
+// of the span (also by a jump), where its result is on top of the stack
+struct PlanProfiler
+{
+    map<const PlanNode *, NodeProfile> nodes;
+    vector<vector<size_t>> opening, closing; // Span indices by instruction
+    vector<chrono::steady_clock::time_point> started;
+    vector<size_t> started_bytes;
+
+    void prepare(const CompiledPlan &plan)
+    {
+        opening.assign(plan.code.size() + 1, vector<size_t>());
+        closing.assign(plan.code.size() + 1, vector<size_t>());
+        started.assign(plan.spans.size(), chrono::steady_clock::time_point());
+        started_bytes.assign(plan.spans.size(), 0);
+        for (size_t i = 0; i < plan.spans.size(); i++)
+        {
+            opening[plan.spans[i].begin].push_back(i);
+            closing[plan.spans[i].end].push_back(i);
+        }
+    }
+
+    // Execution reached instruction pc (code.size() once finished)
+    void reach(const CompiledPlan &plan, size_t pc, const ResultSet *top, DocRange range)
+    {
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        size_t bytes = scanned_bytes_counter();
+        for (size_t i : closing[pc])
+        {
+            NodeProfile &profile = nodes[plan.spans[i].node];
+            profile.output = top->complemented ? (range.end - range.begin) - top->docs.size() : top->docs.size();
+            profile.bytes_decoded = bytes - started_bytes[i];
+            profile.millis = chrono::duration<double, milli>(now - started[i]).count();
+        }
+        if (pc == plan.code.size())
+            return;
+        for (size_t i : opening[pc])
+        {
+            started[i] = now;
+            started_bytes[i] = bytes;
+        }
+    }
+};
+
+// Per-thread evaluation state; every buffer keeps its capacity between
+// queries, so steady-state evaluation does not allocate
+struct PlanScratch
+{
+    deque<ResultSet> stack; // Result slots (a deque so nested runs never move them)
+    size_t depth;
+    vector<ListOperand> operands;
+    DocList decoded, buffer;
+    UnionScratch unions;
+    ResultSet accumulator; // Result of the OR being combined
+    CompiledPlan program; // Program of the query being evaluated on this thread
+
+    PlanScratch() : depth(0) {}
+
+    ResultSet &push()
+    {
+        if (depth == stack.size())
+            stack.push_back(ResultSet());
+        ResultSet &slot = stack[depth++];
+        slot.docs.clear();
+        slot.complemented = false;
+        return slot;
+    }
+
+    ResultSet &top() { return stack[depth - 1]; }
+};
+
+PlanScratch &plan_scratch()
+{
+    static thread_local PlanScratch scratch;
+    return scratch;
+}
+
+// Append a plan's term operands to the operand table
+uint32_t add_term_operands(const vector<const PlanNode *> &leaves, const SearchIndex &index, CompiledPlan &out)
+{
+    uint32_t first = out.terms.size();
+    for (const PlanNode *leaf : leaves)
+    {
+        out.terms.push_back(make_pair(&leaf_source(*leaf, index), leaf_postings(*leaf, index)));
+    }
+    return first;
+}
+
+void compile_plan(const PlanNode &node, const SearchIndex &index, CompiledPlan &out);
+
+// n-way conjunction: term operands are intersected first, rarest first, with
+// adaptive kernels (long lists are probed through skips instead of decoded);
+// computed operands join while anything is left; negated terms are subtracted last
+void compile_conjunction(const PlanNode &node, const SearchIndex &index, CompiledPlan &out)
+{
+    vector<const PlanNode *> terms, excluded_terms, others;
+    for (const auto &child : node.children)
+    {
+        const PlanNode &inner = child.op == PLAN_NOT ? child.children[0] : child;
+        bool term = leaf_postings(inner, index) != nullptr;
+        if (term && child.op == PLAN_NOT)
+            excluded_terms.push_back(&inner);
+        else if (term)
+            terms.push_back(&inner);
+        else
+            others.push_back(&child);
+    }
+
+    bool started = false;
+    if (!terms.empty())
+    {
+        uint32_t first = add_term_operands(terms, index, out);
+        out.code.push_back(PlanInstr(OP_AND_TERMS, first, terms.size()));
+        started = true;
+    }
+
+    // Positional operands go last so they only verify surviving candidates
+    stable_partition(others.begin(), others.end(), [](const PlanNode *child)
+                     { return child->op != PLAN_PHRASE && child->op != PLAN_NEAR; });
+
+    vector<size_t> exits;
+    for (const PlanNode *child : others)
+    {
+        if (started)
+        {
+            exits.push_back(out.code.size());
+            out.code.push_back(PlanInstr(OP_EXIT_IF_EMPTY)); // Conjunction already empty
+        }
+        if ((child->op == PLAN_PHRASE || child->op == PLAN_NEAR) && started)
+        {
+            out.code.push_back(PlanInstr(OP_FILTER_POSITIONAL));
+            out.code.back().node = child;
+            out.spans.push_back(PlanSpan{child, uint32_t(out.code.size() - 1), uint32_t(out.code.size())});
+            continue;
+        }
+        compile_plan(*child, index, out);
+        if (started)
+            out.code.push_back(PlanInstr(OP_AND));
+        started = true;
+    }
+
+    if (!excluded_terms.empty())
+    {
+        // Only negated operands: NOT t1 AND NOT t2 = NOT (t1 OR t2), starting from NOT {}
+        if (!started)
+            out.code.push_back(PlanInstr(OP_EMPTY));
+        uint32_t first = add_term_operands(excluded_terms, index, out);
+        out.code.push_back(PlanInstr(OP_SUBTRACT_TERMS, first, excluded_terms.size()));
+    }
+
+    for (size_t exit : exits)
+    {
+        out.code[exit].target = out.code.size();
+    }
+}
+
+// n-way disjunction: all operands are merged in one pass (heap or bitmap)
+// instead of a left-deep chain of pairwise unions
+void compile_disjunction(const PlanNode &node, const SearchIndex &index, CompiledPlan &out)
+{
+    vector<const PlanNode *> terms;
+    uint32_t sets = 0;
+    for (const auto &child : node.children)
+    {
+        if (leaf_postings(child, index))
+        {
+            terms.push_back(&child);
+        }
+        else
+        {
+            compile_plan(child, index, out);
+            sets++;
+        }
+    }
+
+    uint32_t first = add_term_operands(terms, index, out);
+    out.code.push_back(PlanInstr(OP_OR, first, terms.size()));
+    out.code.back().sets = sets;
+}
+
+// Append the program of a plan node; running it pushes exactly one result set
+void compile_plan(const PlanNode &node, const SearchIndex &index, CompiledPlan &out)
+{
+    uint32_t begin = out.code.size();
+    switch (node.op)
     {
-        if (!is_operator(token))
+    case PLAN_TERM:
+    case PLAN_BIWORD:
+        if (leaf_postings(node, index))
         {
-            // Term - create leaf node
-            node_stack.push(new QueryNode(token));
+            vector<const PlanNode *> leaf(1, &node);
+            out.code.push_back(PlanInstr(OP_TERM, add_term_operands(leaf, index, out), 1));
         }
         else
         {
-            // Operator - pop nodes and create internal node
-            QueryNode *node = new QueryNode(token);
-            if (token == "NOT")
+            out.code.push_back(PlanInstr(OP_EMPTY));
+        }
+        break;
+    case PLAN_NOT:
+        compile_plan(node.children[0], index, out);
+        out.code.push_back(PlanInstr(OP_NOT));
+        break;
+    case PLAN_AND:
+        compile_conjunction(node, index, out);
+        break;
+    case PLAN_OR:
+        compile_disjunction(node, index, out);
+        break;
+    case PLAN_PHRASE:
+    case PLAN_NEAR:
+        out.code.push_back(PlanInstr(OP_POSITIONAL));
+        out.code.back().node = &node;
+        break;
+    case PLAN_EMPTY:
+        out.code.push_back(PlanInstr(OP_EMPTY));
+        break;
+    }
+    out.spans.push_back(PlanSpan{&node, begin, uint32_t(out.code.size())});
+}
+
+// Load operands [first, first + count) of a program as list operands
+void load_term_operands(const CompiledPlan &plan, const PlanInstr &instr, DocRange range, vector<ListOperand> &operands)
+{
+    operands.clear();
+    for (uint32_t i = instr.first; i < instr.first + instr.count; i++)
+    {
+        operands.push_back(ListOperand(*plan.terms[i].first, *plan.terms[i].second, range));
+    }
+}
+
+// Run a compiled program over the doc IDs in range; the result is left in a
+// new slot on top of the scratch stack (the caller pops it)
+ResultSet &run_plan(const CompiledPlan &plan, const SearchIndex &index, DocRange range, PlanScratch &scratch,
+                    PlanProfiler *profiler = nullptr)
+{
+    for (size_t pc = 0; pc < plan.code.size(); pc++)
+    {
+        if (profiler)
+            profiler->reach(plan, pc, scratch.depth > 0 ? &scratch.top() : nullptr, range);
+        const PlanInstr &instr = plan.code[pc];
+        switch (instr.opcode)
+        {
+        case OP_TERM:
+            decode_doc_ids(*plan.terms[instr.first].first, *plan.terms[instr.first].second, scratch.push().docs, range);
+            break;
+        case OP_EMPTY:
+            scratch.push();
+            break;
+        case OP_NOT:
+            scratch.top().complemented = !scratch.top().complemented;
+            break;
+        case OP_AND_TERMS:
+            load_term_operands(plan, instr, range, scratch.operands);
+            intersect_many(scratch.operands, scratch.push().docs, scratch.decoded, scratch.buffer);
+            break;
+        case OP_AND:
+        {
+            ResultSet &operand = scratch.top();
+            scratch.depth--;
+            combine_results(true, scratch.top(), operand, scratch.buffer);
+            break;
+        }
+        case OP_EXIT_IF_EMPTY:
+            if (!scratch.top().complemented && scratch.top().docs.empty())
+                pc = instr.target - 1;
+            break;
+        case OP_SUBTRACT_TERMS:
+        {
+            ResultSet &result = scratch.top();
+            load_term_operands(plan, instr, range, scratch.operands);
+            if (!result.complemented)
             {
-                if (!node_stack.empty())
-                {
-                    node->right = node_stack.top();
-                    node_stack.pop();
-                }
-                else
-                {
-                    // Error: NOT operator without operand
-                    delete node;
-                    // Clean up remaining nodes
-                    while (!node_stack.empty())
-                    {
-                        delete node_stack.top();
-                        node_stack.pop();
-                    }
-                    return nullptr;
-                }
+                subtract_many(result.docs, scratch.operands, scratch.decoded, scratch.buffer);
+                break;
+            }
+            // NOT A AND NOT t = NOT (A OR t)
+            for (const auto &operand : scratch.operands)
+            {
+                decode_doc_ids(*operand.source, *operand.term, scratch.decoded, range);
+                scratch.buffer.clear();
+                union_lists(result.docs.data(), result.docs.size(), scratch.decoded.data(), scratch.decoded.size(),
+                            scratch.buffer);
+                result.docs.swap(scratch.buffer);
+            }
+            break;
+        }
+        case OP_OR:
+        {
+            // Plain computed sets join the n-way union; complemented ones are combined after it
+            size_t first_set = scratch.depth - instr.sets;
+            load_term_operands(plan, instr, range, scratch.operands);
+            for (size_t i = first_set; i < scratch.depth; i++)
+            {
+                if (!scratch.stack[i].complemented)
+                    scratch.operands.push_back(ListOperand(scratch.stack[i].docs.data(), scratch.stack[i].docs.size()));
             }
+            ResultSet &result = scratch.accumulator;
+            union_many(scratch.operands, range, result.docs, scratch.unions);
+            result.complemented = false;
+            for (size_t i = first_set; i < scratch.depth; i++)
+            {
+                if (scratch.stack[i].complemented)
+                    combine_results(false, result, scratch.stack[i], scratch.buffer);
+            }
+
+            scratch.depth = first_set;
+            ResultSet &slot = scratch.push();
+            slot.docs.swap(result.docs);
+            slot.complemented = result.complemented;
+            break;
+        }
+        case OP_POSITIONAL:
+        {
+            ResultSet matches = evaluate_positional(*instr.node, index, range);
+            scratch.push().docs.swap(matches.docs);
+            break;
+        }
+        case OP_FILTER_POSITIONAL:
+        {
+            ResultSet &result = scratch.top();
+            ResultSet matches = evaluate_positional(*instr.node, index, range,
+                                                    result.complemented ? nullptr : &result.docs);
+            if (result.complemented)
+                combine_results(true, result, matches, scratch.buffer);
+            else
+                result.docs.swap(matches.docs);
+            break;
+        }
+        }
+    }
+    if (profiler)
+        profiler->reach(plan, plan.code.size(), &scratch.top(), range);
+    return scratch.top();
+}
+
+// Evaluate an optimized plan into a lazily complemented set of the doc IDs in range
+ResultSet evaluate_plan(const PlanNode &node, const SearchIndex &index, DocRange range)
+{
+    CompiledPlan plan;
+    compile_plan(node, index, plan);
+    PlanScratch &scratch = plan_scratch();
+    ResultSet result;
+    ResultSet &top = run_plan(plan, index, range, scratch);
+    result.docs.swap(top.docs);
+    result.complemented = top.complemented;
+    scratch.depth--;
+    return result;
+}
+
+// Collect the posting lists a plan reads
+void collect_plan_terms(const PlanNode &node, const SearchIndex &index, vector<const TermPostings *> &terms)
+{
+    if (const TermPostings *term = leaf_postings(node, index))
+    {
+        terms.push_back(term);
+    }
+    for (const auto &child : node.children)
+    {
+        collect_plan_terms(child, index, terms);
+    }
+}
+
+// Split the doc ID space into up to parts disjoint ranges holding roughly
+// equal numbers of postings, using the skip entries (block boundaries) of
+// the plan's posting lists as quantile samples
+vector<DocRange> partition_doc_ranges(const PlanNode &plan, const SearchIndex &index, size_t parts)
+{
+    uint32_t num_docs = index.doc_names.size();
+    vector<DocRange> ranges;
+
+    vector<const TermPostings *> terms;
+    collect_plan_terms(plan, index, terms);
+    size_t total_postings = 0;
+    vector<uint32_t> boundaries;
+    for (const TermPostings *term : terms)
+    {
+        total_postings += term->doc_count;
+        for (const auto &skip : term->skips)
+        {
+            boundaries.push_back(skip.doc_id);
+        }
+    }
+
+    if (parts <= 1 || total_postings < PARALLEL_QUERY_MIN_POSTINGS || boundaries.size() < parts)
+    {
+        ranges.push_back(DocRange(0, num_docs));
+        return ranges;
+    }
+
+    sort(boundaries.begin(), boundaries.end());
+    uint32_t begin = 0;
+    for (size_t k = 1; k < parts; k++)
+    {
+        uint32_t split = boundaries[k * boundaries.size() / parts];
+        if (split > begin && split < num_docs)
+        {
+            ranges.push_back(DocRange(begin, split));
+            begin = split;
+        }
+    }
+    ranges.push_back(DocRange(begin, num_docs));
+    return ranges;
+}
+
+// Optimize and evaluate a parsed query into sorted doc IDs. With a range
+// pool, expensive plans run once per doc ID range in parallel; the ranges
+// are disjoint and ordered, so their results simply concatenate.
+DocList evaluate_query(QueryNode *root, const SearchIndex &index, WorkStealingPool *range_pool = nullptr);
+
+// Evaluate an optimized plan into sorted doc IDs (see evaluate_query); a
+// profiled run always covers the whole collection in one range
+DocList evaluate_optimized(const PlanNode &plan, const SearchIndex &index, WorkStealingPool *range_pool,
+                           PlanProfiler *profiler = nullptr)
+{
+    vector<DocRange> ranges = partition_doc_ranges(plan, index, range_pool && !profiler ? range_pool->size() : 1);
+
+    // Compile once into this thread's program buffer; range workers share it read-only
+    PlanScratch &scratch = plan_scratch();
+    CompiledPlan &program = scratch.program;
+    program.clear();
+    compile_plan(plan, index, program);
+
+    if (ranges.size() == 1)
+    {
+        if (profiler)
+            profiler->prepare(program);
+        DocList docs = materialize_result(run_plan(program, index, ranges[0], scratch, profiler), ranges[0]);
+        scratch.depth--;
+        return docs;
+    }
+
+    vector<DocList> parts(ranges.size());
+    range_pool->start(ranges.size(), [&](size_t i)
+                      {
+                          PlanScratch &local = plan_scratch();
+                          parts[i] = materialize_result(run_plan(program, index, ranges[i], local), ranges[i]);
+                          local.depth--; });
+    range_pool->wait();
+
+    DocList docs = move(parts[0]);
+    for (size_t i = 1; i < parts.size(); i++)
+    {
+        docs.insert(docs.end(), parts[i].begin(), parts[i].end());
+    }
+    return docs;
+}
+
+DocList evaluate_query(QueryNode *root, const SearchIndex &index, WorkStealingPool *range_pool)
+{
+    return evaluate_optimized(optimize_query(root, index), index, range_pool);
+}
+
+// Past-the-end doc ID of a plan iterator
+const uint32_t ITERATOR_END = UINT32_MAX;
+
+// Document-at-a-time iterator over an optimized plan, used when only the
+// first matches or the match count are needed: nothing is materialized and
+// evaluation stops as soon as the caller stops asking
+struct PlanIterator
+{
+    PlanOp op;
+    uint32_t doc;                  // Current match (ITERATOR_END when exhausted)
+    bool started;                  // False until the first seek
+    uint32_t universe;             // Only for PLAN_NOT: number of documents
+    size_t positives;              // Only for PLAN_AND: children past this one are excluded
+    vector<PostingCursor> cursors; // Leaf cursor, or the span matcher's cursors
+    SpanMatcher matcher;           // Only for PLAN_PHRASE and PLAN_NEAR
+    vector<PlanIterator> children; // Phrase / NEAR: the doc-level relaxation
+};
+
+PlanIterator make_plan_iterator(const PlanNode &node, const SearchIndex &index)
+{
+    PlanIterator it;
+    it.op = node.op;
+    it.doc = ITERATOR_END;
+    it.started = false;
+    it.universe = index.doc_names.size();
+    it.positives = node.children.size();
+
+    switch (node.op)
+    {
+    case PLAN_TERM:
+    case PLAN_BIWORD:
+        if (const TermPostings *term = leaf_postings(node, index))
+            it.cursors.push_back(PostingCursor(leaf_source(node, index), *term));
+        else
+            it.op = PLAN_EMPTY;
+        break;
+    case PLAN_AND:
+    {
+        // Negated children are iterated unwrapped and reject candidates they hit
+        vector<const PlanNode *> excluded;
+        for (const auto &child : node.children)
+        {
+            if (child.op == PLAN_NOT)
+                excluded.push_back(&child.children[0]);
+            else
+                it.children.push_back(make_plan_iterator(child, index));
+        }
+        it.positives = it.children.size();
+        for (const PlanNode *child : excluded)
+        {
+            if (it.positives == 0)
+                it.children.push_back(make_plan_iterator(negate_plan(*child, it.universe), index));
             else
+                it.children.push_back(make_plan_iterator(*child, index));
+        }
+        if (it.positives == 0)
+            it.positives = it.children.size();
+        if (it.positives == 0)
+            it.op = PLAN_EMPTY;
+        break;
+    }
+    case PLAN_PHRASE:
+    case PLAN_NEAR:
+        it.matcher = compile_span_matcher(node, index, it.cursors);
+        it.children.push_back(make_plan_iterator(relax_positional(node, it.universe), index));
+        break;
+    default:
+        for (const auto &child : node.children)
+        {
+            it.children.push_back(make_plan_iterator(child, index));
+        }
+        break;
+    }
+    return it;
+}
+
+// Move to the first match >= target and return it; targets must not
+// decrease, and a seek behind the current match leaves it in place
+uint32_t seek_plan(PlanIterator &it, uint32_t target)
+{
+    if (it.started && it.doc >= target)
+        return it.doc;
+    it.started = true;
+
+    uint32_t candidate = target;
+    switch (it.op)
+    {
+    case PLAN_TERM:
+    case PLAN_BIWORD:
+    {
+        PostingCursor &cursor = it.cursors[0];
+        cursor.advance(target);
+        candidate = cursor.at_end() ? ITERATOR_END : cursor.doc_id;
+        break;
+    }
+    case PLAN_OR:
+        candidate = ITERATOR_END;
+        for (auto &child : it.children)
+        {
+            candidate = min(candidate, seek_plan(child, target));
+        }
+        break;
+    case PLAN_NOT:
+        // Walk the universe, stepping over the child's matches
+        while (candidate < it.universe && seek_plan(it.children[0], candidate) == candidate)
+        {
+            candidate++;
+        }
+        if (candidate >= it.universe)
+            candidate = ITERATOR_END;
+        break;
+    case PLAN_AND:
+        while (candidate != ITERATOR_END)
+        {
+            // Leapfrog the positive children until all of them sit on one document
+            size_t agreed = 0;
+            for (size_t i = 0; agreed < it.positives && candidate != ITERATOR_END; i = (i + 1) % it.positives)
             {
-                // Binary operator (AND, OR)
-                if (node_stack.size() >= 2)
-                {
-                    node->right = node_stack.top();
-                    node_stack.pop();
-                    node->left = node_stack.top();
-                    node_stack.pop();
-                }
-                else
-                {
-                    // Error: Binary operator without enough operands
-                    delete node;
-                    // Clean up remaining nodes
-                    while (!node_stack.empty())
-                    {
-                        delete node_stack.top();
-                        node_stack.pop();
-                    }
-                    return nullptr;
-                }
+                uint32_t doc = seek_plan(it.children[i], candidate);
+                agreed = doc == candidate ? agreed + 1 : 1;
+                candidate = doc;
+            }
+            if (candidate == ITERATOR_END)
+                break;
+
+            // Any excluded child on the same document rejects it
+            bool rejected = false;
+            for (size_t i = it.positives; i < it.children.size() && !rejected; i++)
+            {
+                rejected = seek_plan(it.children[i], candidate) == candidate;
             }
-            node_stack.push(node);
+            if (!rejected)
+                break;
+            candidate++;
         }
+        break;
+    case PLAN_PHRASE:
+    case PLAN_NEAR:
+    {
+        // Check positions only on documents the relaxation accepts
+        vector<PositionSpan> spans;
+        while ((candidate = seek_plan(it.children[0], candidate)) != ITERATOR_END &&
+               !match_spans(it.matcher, candidate, it.cursors, spans))
+        {
+            candidate++;
+        }
+        break;
+    }
+    case PLAN_EMPTY:
+        candidate = ITERATOR_END;
+        break;
     }
 
-    // Should have exactly one node left (the root)
-    if (node_stack.size() == 1)
+    it.doc = candidate;
+    return candidate;
+}
+
+// Number of documents matched by a plan, stopping at limit. Leaves and
+// unlimited complements are answered from document frequencies alone.
+size_t count_plan_matches(const PlanNode &plan, const SearchIndex &index, size_t limit = SIZE_MAX)
+{
+    const TermPostings *term = leaf_postings(plan, index);
+    if (plan.op == PLAN_EMPTY)
+        return 0;
+    if (term)
+        return min<size_t>(term->doc_count, limit);
+    if (plan.op == PLAN_NOT && limit == SIZE_MAX)
+        return index.doc_names.size() - count_plan_matches(plan.children[0], index);
+
+    PlanIterator it = make_plan_iterator(plan, index);
+    size_t count = 0;
+    for (uint32_t doc = seek_plan(it, 0); doc != ITERATOR_END && count < limit; doc = seek_plan(it, doc + 1))
     {
-        return node_stack.top();
+        count++;
     }
-    else
+    return count;
+}
+
+// First limit matches of a plan in doc ID order
+DocList first_plan_matches(const PlanNode &plan, const SearchIndex &index, size_t limit)
+{
+    DocList docs;
+    if (limit == 0)
+        return docs;
+    PlanIterator it = make_plan_iterator(plan, index);
+    for (uint32_t doc = seek_plan(it, 0); doc != ITERATOR_END; doc = seek_plan(it, doc + 1))
+    {
+        docs.push_back(doc);
+        if (docs.size() >= limit)
+            break;
+    }
+    return docs;
+}
+
+// Ranked retrieval uses the positive terms of a query as a bag of words:
+// operators only decide which terms count (terms under NOT are dropped),
+// phrase terms count individually, a wildcard counts every term it
+// expands to, and repeats raise the query weight
+void collect_ranked_terms(QueryNode *node, const SearchIndex &index, bool negated, map<string, uint32_t> &weights)
+{
+    if (!node)
+        return;
+    if (node->type == TOKEN_WILDCARD)
     {
-        // Error: malformed expression
-        while (!node_stack.empty())
+        vector<uint32_t> matches;
+        expand_wildcard(node->value, index.term_list, index.permuterm, matches);
+        for (size_t i = 0; !negated && i < matches.size(); i++)
         {
-            delete node_stack.top();
-            node_stack.pop();
+            weights[*index.term_list[matches[i]]]++;
         }
-        return nullptr;
+        return;
+    }
+    if (!is_operator_token(node->type))
+    {
+        istringstream words(node->value);
+        string word;
+        while (!negated && words >> word)
+        {
+            weights[word]++;
+        }
+        return;
     }
+    collect_ranked_terms(node->left, index, negated, weights);
+    collect_ranked_terms(node->right, index, node->type == TOKEN_NOT ? !negated : negated, weights);
 }
 
-// evaluate_tree function
-vector<string> evaluate_tree(QueryNode *root,
-                             const map<string, map<string, vector<uint32_t>>> &index)
+// One query term during block-max WAND: cursor, weight and score bounds
+struct RankedCursor
 {
+    PostingCursor cursor;
+    const TermScoreBounds *bounds;
+    double idf;
+    double weight;    // Query term frequency
+    double max_score; // Upper bound of this term's contribution to any document
+    size_t block;     // Score block of the last shallow lookup (only moves forward)
+
+    // idf uses the collection statistics of bm25.bin (all shards' for a shard)
+    RankedCursor(const CompressedPostings &postings, const TermPostings &term, const TermScoreBounds &b,
+                 uint64_t collection_size, uint32_t qtf)
+        : cursor(postings, term), bounds(&b), idf(bm25_idf(b.df, collection_size)), weight(qtf),
+          max_score(qtf * (double)b.max_score), block(0)
+    {
+    }
 
-    if (!root)
-        return {};
+    // Move the shallow pointer to the block that may hold doc_id (without decoding)
+    void seek_block(uint32_t doc_id)
+    {
+        block = max(block, (size_t)(cursor.index / SCORE_BLOCK_SIZE));
+        while (block < bounds->blocks.size() && bounds->blocks[block].last_doc < doc_id)
+            block++;
+    }
+
+    // Upper bound of this term's contribution to doc_id
+    double block_max(uint32_t doc_id)
+    {
+        seek_block(doc_id);
+        return block < bounds->blocks.size() ? weight * bounds->blocks[block].max_score : 0.0;
+    }
+
+    // Last doc ID covered by the bound returned by block_max
+    uint32_t block_end() const
+    {
+        return block < bounds->blocks.size() ? bounds->blocks[block].last_doc : UINT32_MAX - 1;
+    }
+
+    double score(const RankingStats &stats) const
+    {
+        return weight * bm25_score(idf, cursor.tf, stats.doc_lengths[cursor.doc_id], stats);
+    }
+};
+
+// Ordering of ranked results: higher score first, then lower doc ID
+struct BetterResult
+{
+    bool operator()(const pair<double, uint32_t> &a, const pair<double, uint32_t> &b) const
+    {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    }
+};
+
+// Top-k BM25 by block-max WAND. Cursors are kept in doc ID order; the pivot
+// is the first document whose summed term maxima could beat the current k-th
+// score. Its block maxima are then checked without decoding, and failing
+// blocks are skipped whole. Only documents passing both bounds are scored.
+void rank_bm25(const map<string, uint32_t> &weights, const SearchIndex &index, size_t k,
+               DocList &docs, vector<double> &scores)
+{
+    docs.clear();
+    scores.clear();
+    if (k == 0)
+        return;
+
+    vector<RankedCursor> cursors;
+    for (const auto &weight : weights)
+    {
+        const TermPostings *term = find_term(index.postings, weight.first);
+        auto bounds = index.score_bounds.find(weight.first);
+        if (term && term->doc_count > 0 && bounds != index.score_bounds.end())
+            cursors.push_back(RankedCursor(index.postings, *term, bounds->second, index.ranking.collection_size,
+                                           weight.second));
+    }
+
+    vector<RankedCursor *> order;
+    for (auto &cursor : cursors)
+    {
+        order.push_back(&cursor);
+    }
 
-    if (!is_operator(root->value))
+    // Min-heap on BetterResult: the top is the current k-th best
+    priority_queue<pair<double, uint32_t>, vector<pair<double, uint32_t>>, BetterResult> top;
+    while (true)
     {
-        // Leaf node (term)
-        auto it = index.find(root->value);
-        if (it != index.end())
+        order.erase(remove_if(order.begin(), order.end(), [](const RankedCursor *c)
+                              { return c->cursor.at_end(); }),
+                    order.end());
+        sort(order.begin(), order.end(), [](const RankedCursor *a, const RankedCursor *b)
+             { return a->cursor.doc_id < b->cursor.doc_id; });
+        double threshold = top.size() < k ? 0.0 : top.top().first;
+
+        // Pivot: first cursor at which the summed maxima exceed the threshold
+        double upper = 0;
+        size_t pivot = 0;
+        for (; pivot < order.size(); pivot++)
         {
-            vector<string> docs;
-            for (const auto &doc_entry : it->second)
+            upper += order[pivot]->max_score;
+            if (upper > threshold)
+                break;
+        }
+        if (pivot == order.size())
+            break;
+        uint32_t pivot_doc = order[pivot]->cursor.doc_id;
+        while (pivot + 1 < order.size() && order[pivot + 1]->cursor.doc_id == pivot_doc)
+            pivot++;
+
+        // Block-max check: no document before next_doc can beat the threshold
+        double block_upper = 0;
+        uint32_t next_doc = pivot + 1 < order.size() ? order[pivot + 1]->cursor.doc_id : UINT32_MAX;
+        for (size_t i = 0; i <= pivot; i++)
+        {
+            block_upper += order[i]->block_max(pivot_doc);
+            next_doc = min(next_doc, order[i]->block_end() + 1);
+        }
+        if (block_upper <= threshold)
+        {
+            for (size_t i = 0; i <= pivot; i++)
             {
-                docs.push_back(doc_entry.first);
+                order[i]->cursor.advance(next_doc);
             }
-            sort(docs.begin(), docs.end());
-            return docs;
+            continue;
         }
-        else
+
+        if (order[0]->cursor.doc_id != pivot_doc)
+        {
+            // Documents before the pivot cannot make the top k
+            for (size_t i = 0; i < pivot; i++)
+            {
+                order[i]->cursor.advance(pivot_doc);
+            }
+            continue;
+        }
+
+        double score = 0;
+        for (size_t i = 0; i <= pivot; i++)
+        {
+            score += order[i]->score(index.ranking);
+            order[i]->cursor.next();
+        }
+        if (top.size() < k)
+        {
+            top.push(make_pair(score, pivot_doc));
+        }
+        else if (score > threshold)
+        {
+            top.pop();
+            top.push(make_pair(score, pivot_doc));
+        }
+    }
+
+    vector<pair<double, uint32_t>> results;
+    while (!top.empty())
+    {
+        results.push_back(top.top());
+        top.pop();
+    }
+    sort(results.begin(), results.end(), BetterResult());
+    for (const auto &result : results)
+    {
+        docs.push_back(result.second);
+        scores.push_back(result.first);
+    }
+}
+
+// Build search structures straight from an in-memory index (used when no
+// compressed index has been loaded by decompress_index)
+void build_search_index(const map<string, map<string, vector<uint32_t>>> &inverted_index,
+                        SearchIndex &search_index)
+{
+    set<string> all_docs;
+    for (const auto &term_entry : inverted_index)
+    {
+        for (const auto &doc_entry : term_entry.second)
+        {
+            all_docs.insert(doc_entry.first);
+        }
+    }
+    search_index.doc_names.assign(all_docs.begin(), all_docs.end());
+    search_index.names_sorted = true;
+
+    // Encode postings in the postings.bin layout
+    vector<uint8_t> data;
+    map<string, pair<size_t, size_t>> metadata;
+    for (const auto &term_entry : inverted_index)
+    {
+        size_t offset = data.size();
+        append_vbyte(term_entry.second.size(), data);
+        for (const auto &doc_entry : term_entry.second)
         {
-            return {}; // Term not found
+            const vector<string> &names = search_index.doc_names;
+            uint32_t doc_id = lower_bound(names.begin(), names.end(), doc_entry.first) - names.begin();
+            const vector<uint32_t> &positions = doc_entry.second;
+
+            append_vbyte(doc_id, data);
+            append_vbyte(positions.size(), data);
+            for (size_t i = 0; i < positions.size(); i++)
+            {
+                append_vbyte(i == 0 ? positions[0] : positions[i] - positions[i - 1], data);
+            }
         }
+        metadata[term_entry.first] = make_pair(offset, data.size() - offset);
     }
 
-    // Internal node (operator)
-    vector<string> left_result = evaluate_tree(root->left, index);
-    vector<string> right_result = evaluate_tree(root->right, index);
+    load_compressed_postings(search_index.postings, move(data), metadata);
+    build_term_list(search_index);
+    if (global_options.ranked)
+    {
+        compute_ranking_stats(search_index);
+    }
+}
 
-    if (root->value == "AND")
+// Use the index loaded by decompress_index, or build one from inverted_index
+const SearchIndex &select_search_index(const map<string, map<string, vector<uint32_t>>> &inverted_index,
+                                       SearchIndex &fallback)
+{
+    if (!global_search_index.postings.terms.empty() || !global_shards.empty() || inverted_index.empty())
     {
-        vector<string> result;
-        set_intersection(left_result.begin(), left_result.end(),
-                         right_result.begin(), right_result.end(),
-                         back_inserter(result));
-        return result;
+        return global_search_index;
     }
-    else if (root->value == "OR")
+    build_search_index(inverted_index, fallback);
+    return fallback;
+}
+
+// Map doc IDs to document names in lexicographic order
+vector<string> doc_names_for(const DocList &doc_ids, const SearchIndex &index)
+{
+    vector<string> names;
+    names.reserve(doc_ids.size());
+    for (uint32_t doc_id : doc_ids)
     {
-        vector<string> result;
-        set_union(left_result.begin(), left_result.end(),
-                  right_result.begin(), right_result.end(),
-                  back_inserter(result));
-        return result;
+        names.push_back(index.doc_names[doc_id]);
     }
-    else if (root->value == "NOT")
+    if (!index.names_sorted)
     {
-        // NOT operator - only right child is relevant
-
-        vector<string> result;
-        set_difference(global_all_docs.begin(), global_all_docs.end(),
-                       right_result.begin(), right_result.end(),
-                       back_inserter(result));
-        return result;
+        sort(names.begin(), names.end());
     }
+    return names;
+}
 
-    return {};
+// evaluate_tree function
+vector<string> evaluate_tree(QueryNode *root,
+                             const map<string, map<string, vector<uint32_t>>> &index)
+{
+    SearchIndex fallback;
+    const SearchIndex &search_index = select_search_index(index, fallback);
+    return doc_names_for(evaluate_query(root, search_index), search_index);
 }
 
 // Query parser function as required by assignment (Task 4.3)
@@ -702,21 +2838,93 @@ QueryNode *query_parser(vector<string> query_tokens)
     return build_tree(postfix);
 }
 
-void print_tree(QueryNode *node, int depth = 0)
+const char *plan_op_name(PlanOp op)
 {
-    if (!node)
-        return;
-    print_tree(node->right, depth + 1);
-    for (int i = 0; i < depth; i++)
-        cout << "    ";
-    cout << node->value << "\n";
-    print_tree(node->left, depth + 1);
+    static const char *names[] = {"TERM", "BIWORD", "AND", "OR", "NOT", "PHRASE", "NEAR", "EMPTY"};
+    return names[op];
+}
+
+void append_millis(string &out, double millis)
+{
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%.3f", millis);
+    out.append(text, length);
+}
+
+// Documents a node reads: the outputs of its operands, where a term operand
+// folded into its parent's instruction (also as an excluded NOT term)
+// contributes its document frequency
+size_t plan_input_size(const PlanNode &plan, const SearchIndex &index, const PlanProfiler &profiler)
+{
+    const TermPostings *postings = leaf_postings(plan, index);
+    if (postings)
+        return postings->doc_count;
+
+    size_t input = 0;
+    for (const PlanNode &child : plan.children)
+    {
+        auto it = profiler.nodes.find(&child);
+        const PlanNode &operand = child.op == PLAN_NOT ? child.children[0] : child;
+        if (it != profiler.nodes.end())
+            input += it->second.output;
+        else if ((postings = leaf_postings(operand, index)) != nullptr)
+            input += postings->doc_count;
+    }
+    return input;
+}
+
+// Append a plan tree as a JSON object: operator, estimated cardinality and
+// leaf document frequencies; with a profiler, every node that ran as its own
+// span also reports its actual input/output sizes, bytes decoded and time
+void append_plan_json(string &out, const PlanNode &plan, const SearchIndex &index,
+                      const PlanProfiler *profiler = nullptr)
+{
+    out += "{\"op\":\"";
+    out += plan_op_name(plan.op);
+    out += "\"";
+    if (plan.op == PLAN_TERM || plan.op == PLAN_BIWORD)
+    {
+        const TermPostings *postings = leaf_postings(plan, index);
+        out += ",\"term\":\"" + escape_json_string(plan.term) + "\"";
+        out += ",\"df\":" + to_string(postings ? postings->doc_count : 0);
+    }
+    if (plan.op == PLAN_NEAR)
+        out += ",\"window\":" + to_string(plan.window);
+    if (plan.offset > 0)
+        out += ",\"offset\":" + to_string(plan.offset);
+    out += ",\"estimate\":" + to_string(plan.estimate);
+
+    auto it = profiler ? profiler->nodes.find(&plan) : map<const PlanNode *, NodeProfile>::const_iterator();
+    if (profiler && it != profiler->nodes.end())
+    {
+        out += ",\"input\":" + to_string(plan_input_size(plan, index, *profiler));
+        out += ",\"output\":" + to_string(it->second.output);
+        out += ",\"bytes_decoded\":" + to_string(it->second.bytes_decoded);
+        out += ",\"time_ms\":";
+        append_millis(out, it->second.millis);
+    }
+
+    if (!plan.children.empty())
+    {
+        out += ",\"children\":[";
+        for (size_t i = 0; i < plan.children.size(); i++)
+        {
+            if (i > 0)
+                out += ',';
+            append_plan_json(out, plan.children[i], index, profiler);
+        }
+        out += ']';
+    }
+    out += '}';
 }
 
-// Helper function to load stopwords with fallback paths
-unordered_set<string> load_stopwords_with_fallback(const string &output_dir)
+// Helper function to load stopwords with fallback paths (indexes built before
+// analyzer.bin). The query lexer's table also holds the operator words, so
+// one lookup classifies a word.
+WordTable load_stopwords_with_fallback(const string &output_dir)
 {
-    unordered_set<string> stopwords;
+    WordTable stopwords;
+    add_operator_words(stopwords);
 
     // Try output_dir/../stopwords.txt first
     string primary_path = output_dir + "/../stopwords.txt";
@@ -743,298 +2951,470 @@ unordered_set<string> load_stopwords_with_fallback(const string &output_dir)
             word.erase(word.find_last_not_of(" \t\r\n") + 1);
             if (!word.empty())
             {
-                stopwords.insert(word);
+                stopwords.add(word, WORD_STOPWORD);
             }
         }
         file.close();
     }
+    stopwords.build();
 
     return stopwords;
 }
 
-// Helper function to parse queries from JSON file
-vector<pair<string, string>> parse_queries_file(const string &path_to_query_file)
+// One query to answer, with its result options
+struct QueryRequest
+{
+    string qid;
+    string title;
+    size_t limit;    // Stop after this many matching documents
+    bool count_only; // Report the number of matches instead of the documents
+    bool explain;    // Report the optimized plan instead of evaluating
+    bool profile;    // Evaluate and report the plan with per-node costs
+
+    QueryRequest(const string &q = "", const string &t = "")
+        : qid(q), title(t), limit(global_options.limit), count_only(global_options.count_only),
+          explain(global_options.explain), profile(global_options.profile) {}
+};
+
+// True if line[begin, end) equals key
+bool span_equals(const string &line, size_t begin, size_t end, const char *key)
+{
+    size_t length = strlen(key);
+    return end - begin == length && line.compare(begin, length, key) == 0;
+}
+
+// End of the JSON value starting at pos: past the closing quote of a
+// string, the matching bracket of an object / array, or the last character
+// of a number or literal (npos if unterminated)
+size_t skip_json_value(const string &line, size_t pos)
 {
-    vector<pair<string, string>> queries; // (qid, title) pairs
-    
-    // First try to detect UTF-16 encoding
-    ifstream detect_file(path_to_query_file, ios::binary);
-    if (!detect_file.is_open())
+    if (line[pos] == '"')
     {
-        cerr << "Warning: Cannot open query file: " << path_to_query_file << endl;
-        return queries;
-    }
-    
-    // Read first 2 bytes to check for UTF-16 BOM
-    char bom[2];
-    detect_file.read(bom, 2);
-    detect_file.close();
-    
-    bool is_utf16 = (bom[0] == (char)0xFF && bom[1] == (char)0xFE);
-    
-    if (is_utf16)
-    {
-        cout << "Detected UTF-16 encoding in: " << path_to_query_file << endl;
-        
-        // Read the entire file as binary
-        ifstream binary_file(path_to_query_file, ios::binary);
-        vector<char> buffer((istreambuf_iterator<char>(binary_file)), istreambuf_iterator<char>());
-        binary_file.close();
-        
-        // Convert UTF-16 LE to UTF-8/ASCII
-        string content;
-        for (size_t i = 2; i < buffer.size(); i += 2) // Skip BOM, read 2 bytes at a time
-        {
-            if (i + 1 < buffer.size())
+        size_t end = find_json_string_end(line, pos + 1);
+        return end == string::npos ? end : end + 1;
+    }
+    if (line[pos] == '{' || line[pos] == '[')
+    {
+        size_t depth = 0;
+        for (size_t i = pos; i < line.size(); i++)
+        {
+            if (line[i] == '"')
             {
-                // For ASCII characters in UTF-16 LE, the high byte is 0
-                char ascii_char = buffer[i];
-                char high_byte = buffer[i + 1];
-                
-                if (high_byte == 0 && ascii_char != 0) // Valid ASCII character
-                {
-                    content += ascii_char;
-                }
-                else if (ascii_char == 0 && high_byte == 0) // Null terminator
-                {
-                    break;
-                }
+                i = find_json_string_end(line, i + 1);
+                if (i == string::npos)
+                    return i;
             }
-        }
-        
-        // Parse the converted content line by line
-        istringstream content_stream(content);
-        string line;
-        int line_count = 0;
-        while (getline(content_stream, line))
-        {
-            line_count++;
-            // Remove leading/trailing whitespace
-            line.erase(0, line.find_first_not_of(" \t"));
-            line.erase(line.find_last_not_of(" \t") + 1);
-
-            if (line.empty()) {
-                continue;
+            else if (line[i] == '{' || line[i] == '[')
+            {
+                depth++;
             }
-            if (line[0] != '{') {
-                continue;
+            else if ((line[i] == '}' || line[i] == ']') && --depth == 0)
+            {
+                return i + 1;
             }
+        }
+        return string::npos;
+    }
+    size_t end = line.find_first_of(",} \t\r", pos);
+    return end == string::npos ? line.size() : end;
+}
 
-            string qid, title;
-            bool has_qid = false, has_title = false;
+// Parse a one-line JSON query object in a single pass: query_id, title and
+// the per-query options "limit": N, "count_only", "explain" and "profile"
+// (true / false); other keys are skipped. Titles keep their escapes except
+// \" (phrase quotes), like extract_json_string. False unless both query_id
+// and title are present.
+bool parse_query_line(const string &line, QueryRequest &request)
+{
+    bool has_qid = false, has_title = false;
+    size_t pos = line.find('{');
+    while (pos != string::npos && pos < line.size())
+    {
+        pos = line.find('"', pos + 1);
+        if (pos == string::npos)
+            break;
+        size_t key_end = find_json_string_end(line, pos + 1);
+        size_t value = key_end == string::npos ? key_end : line.find_first_not_of(" \t:", key_end + 1);
+        if (value == string::npos)
+            break;
+        size_t value_end = skip_json_value(line, value);
+        if (value_end == string::npos)
+            break;
 
-            // Simple JSON parsing for qid and title
-            size_t pos = 0;
-            while (pos < line.length())
-            {
-                // Look for "query_id" field
-                size_t qid_pos = line.find("\"query_id\"", pos);
-                if (qid_pos != string::npos)
-                {
-                    size_t colon_pos = line.find(":", qid_pos);
-                    if (colon_pos != string::npos)
-                    {
-                        size_t value_start = line.find("\"", colon_pos);
-                        if (value_start != string::npos)
-                        {
-                            value_start++;
-                            size_t value_end = line.find("\"", value_start);
-                            if (value_end != string::npos)
-                            {
-                                qid = line.substr(value_start, value_end - value_start);
-                                has_qid = true;
-                            }
-                        }
-                    }
-                }
+        size_t key = pos + 1;
+        bool text = line[value] == '"';
+        size_t begin = text ? value + 1 : value, end = text ? value_end - 1 : value_end;
+        if (span_equals(line, key, key_end, "query_id"))
+        {
+            request.qid = text ? unescape_json_quotes(line.substr(begin, end - begin)) : line.substr(begin, end - begin);
+            has_qid = true;
+        }
+        else if (span_equals(line, key, key_end, "title") && text)
+        {
+            request.title = unescape_json_quotes(line.substr(begin, end - begin));
+            has_title = true;
+        }
+        else if (span_equals(line, key, key_end, "limit") && isdigit((unsigned char)line[value]))
+        {
+            // The number's leading digits; a limit past SIZE_MAX is no limit
+            size_t digits = min(end, line.find_first_not_of("0123456789", begin));
+            uint64_t limit = 0;
+            request.limit = parse_unsigned(line.substr(begin, digits - begin), SIZE_MAX, limit) ? limit : SIZE_MAX;
+        }
+        else if (!text && (span_equals(line, value, value_end, "true") || span_equals(line, value, value_end, "false")))
+        {
+            bool flag = line[value] == 't';
+            if (span_equals(line, key, key_end, "count_only"))
+                request.count_only = flag;
+            else if (span_equals(line, key, key_end, "explain"))
+                request.explain = flag;
+            else if (span_equals(line, key, key_end, "profile"))
+                request.profile = flag;
+        }
 
-                // Look for "title" field
-                size_t title_pos = line.find("\"title\"", pos);
-                if (title_pos != string::npos)
-                {
-                    size_t colon_pos = line.find(":", title_pos);
-                    if (colon_pos != string::npos)
-                    {
-                        size_t value_start = line.find("\"", colon_pos);
-                        if (value_start != string::npos)
-                        {
-                            value_start++;
-                            size_t value_end = line.find("\"", value_start);
-                            if (value_end != string::npos)
-                            {
-                                title = line.substr(value_start, value_end - value_start);
-                                has_title = true;
-                            }
-                        }
-                    }
-                }
+        // Continue after the separator following this value
+        pos = line.find_first_of(",}", value_end);
+        if (pos == string::npos || line[pos] == '}')
+            break;
+    }
+    return has_qid && has_title;
+}
 
-                if (has_qid && has_title)
-                    break;
+// Streaming reader of a JSON-lines query file (UTF-8 or UTF-16LE/BE,
+// transcoded): one QueryRequest per line with a query_id and title
+class QueryFileReader
+{
+public:
+    QueryFileReader() : parsed_(0) {}
 
-                pos = max(qid_pos, title_pos);
-                if (pos == string::npos)
-                    break;
-                pos++;
-            }
+    bool open(const string &path)
+    {
+        if (!lines_.open(path))
+            return false;
+        if (lines_.encoding() != ENCODING_UTF8)
+            status_stream() << "Detected UTF-16 encoding in: " << path << endl;
+        else
+            status_stream() << "Processing UTF-8 file: " << path << endl;
+        return true;
+    }
 
-            if (has_qid && has_title)
+    // Read the next valid query into request; false at end of file
+    bool next(QueryRequest &request)
+    {
+        while (lines_.next_line(line_))
+        {
+            size_t first = line_.find_first_not_of(" \t");
+            if (first == string::npos || line_[first] != '{')
+                continue;
+            request = QueryRequest();
+            if (parse_query_line(line_, request))
             {
-                queries.push_back(make_pair(qid, title));
+                parsed_++;
+                return true;
             }
         }
+        return false;
     }
-    else
-    {
-        // Regular UTF-8/ASCII file processing
-        ifstream file(path_to_query_file);
-        if (!file.is_open())
-        {
-            cerr << "Warning: Cannot open query file: " << path_to_query_file << endl;
-            return queries;
-        }
 
-        cout << "Processing UTF-8 file: " << path_to_query_file << endl;
+    size_t parsed() const { return parsed_; }
 
-        string line;
-        int line_count = 0;
-        while (getline(file, line))
-        {
-            line_count++;
-            // Remove leading/trailing whitespace
-            line.erase(0, line.find_first_not_of(" \t"));
-            line.erase(line.find_last_not_of(" \t") + 1);
+private:
+    LineReader lines_;
+    string line_;
+    size_t parsed_;
+};
 
-            if (line.empty()) {
-                continue;
-            }
-            if (line[0] != '{') {
-                continue;
-            }
+// Outcome of evaluating one query of a batch
+struct QueryOutcome
+{
+    bool parsed;           // False if the query is malformed
+    DocList doc_ids;       // Matching documents, sorted (ranked mode: by rank)
+    vector<double> scores; // BM25 scores in ranked mode, parallel to doc_ids
+    size_t count;          // Number of matches (count-only queries)
+    string plan;           // JSON plan report (EXPLAIN / PROFILE queries)
 
-            string qid, title;
-            bool has_qid = false, has_title = false;
+    QueryOutcome() : parsed(true), count(0) {}
+};
 
-            // Simple JSON parsing for qid and title
-            size_t pos = 0;
-            while (pos < line.length())
-            {
-                // Look for "query_id" field
-                size_t qid_pos = line.find("\"query_id\"", pos);
-                if (qid_pos != string::npos)
-                {
-                    size_t colon_pos = line.find(":", qid_pos);
-                    if (colon_pos != string::npos)
-                    {
-                        size_t value_start = line.find("\"", colon_pos);
-                        if (value_start != string::npos)
-                        {
-                            value_start++;
-                            size_t value_end = line.find("\"", value_start);
-                            if (value_end != string::npos)
-                            {
-                                qid = line.substr(value_start, value_end - value_start);
-                                has_qid = true;
-                            }
-                        }
-                    }
-                }
+// JSON plan report of one query; time_ms and results only for PROFILE
+string plan_report(const QueryRequest &query, const string &mode, const PlanNode &plan,
+                   const SearchIndex &index, const PlanProfiler *profiler, double millis, size_t results)
+{
+    string out = "{\"query_id\":\"" + escape_json_string(query.qid) + "\",\"mode\":\"" + mode + "\"";
+    if (index.shard >= 0)
+        out += ",\"shard\":" + to_string(index.shard);
+    if (mode == "profile")
+    {
+        out += ",\"time_ms\":";
+        append_millis(out, millis);
+        out += ",\"results\":" + to_string(results);
+    }
+    out += ",\"plan\":";
+    append_plan_json(out, plan, index, profiler);
+    out += "}\n";
+    return out;
+}
 
-                // Look for "title" field
-                size_t title_pos = line.find("\"title\"", pos);
-                if (title_pos != string::npos)
-                {
-                    size_t colon_pos = line.find(":", title_pos);
-                    if (colon_pos != string::npos)
-                    {
-                        size_t value_start = line.find("\"", colon_pos);
-                        if (value_start != string::npos)
-                        {
-                            value_start++;
-                            size_t value_end = line.find("\"", value_start);
-                            if (value_end != string::npos)
-                            {
-                                title = line.substr(value_start, value_end - value_start);
-                                has_title = true;
-                            }
-                        }
-                    }
-                }
+// Answer a parsed query in its result mode: count, ranked, limited or full
+void answer_query(const QueryRequest &query, QueryNode *root, const SearchIndex &search_index,
+                  WorkStealingPool *range_pool, QueryOutcome &outcome)
+{
+    if (query.count_only)
+    {
+        // Counts always refer to Boolean matches, even in ranked mode
+        outcome.count = count_plan_matches(optimize_query(root, search_index), search_index, query.limit);
+    }
+    else if (global_options.ranked)
+    {
+        map<string, uint32_t> weights;
+        collect_ranked_terms(root, search_index, false, weights);
+        rank_bm25(weights, search_index, min(global_options.top_k, query.limit), outcome.doc_ids, outcome.scores);
+    }
+    else if (query.limit != SIZE_MAX)
+    {
+        outcome.doc_ids = first_plan_matches(optimize_query(root, search_index), search_index, query.limit);
+    }
+    else
+    {
+        outcome.doc_ids = evaluate_query(root, search_index, range_pool);
+    }
+}
 
-                if (has_qid && has_title)
-                    break;
+// Evaluate one query against the shared read-only index (safe to call from
+// several threads at once)
+QueryOutcome run_query(const QueryRequest &query, const WordTable &stopwords,
+                       const SearchIndex &search_index, WorkStealingPool *range_pool = nullptr)
+{
+    QueryOutcome outcome;
 
-                pos = max(qid_pos, title_pos);
-                if (pos == string::npos)
-                    break;
-                pos++;
-            }
+    // Lex the query into typed tokens (terms resolved against the dictionary)
+    QueryTokens &tokens = query_arena().tokens;
+    lex_query(query.title, stopwords, &search_index.postings, tokens);
+    if (tokens.count == 0)
+    {
+        return outcome; // Empty query, nothing to write
+    }
 
-            if (has_qid && has_title)
-            {
-                queries.push_back(make_pair(qid, title));
-            }
-        }
-        file.close();
+    // Convert to postfix and build tree
+    QueryNode *root = build_tree(tokens);
+    if (root == nullptr)
+    {
+        outcome.parsed = false;
+        return outcome;
+    }
+
+    if (query.explain)
+    {
+        outcome.plan = plan_report(query, "explain", optimize_query(root, search_index), search_index, nullptr, 0, 0);
+        return outcome;
+    }
+
+    if (query.profile)
+    {
+        // Full Boolean queries are profiled per plan node; the other modes
+        // report the plan with the time of the whole query
+        PlanNode plan = optimize_query(root, search_index);
+        PlanProfiler profiler;
+        bool per_node = !query.count_only && !global_options.ranked && query.limit == SIZE_MAX;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (per_node)
+            outcome.doc_ids = evaluate_optimized(plan, search_index, range_pool, &profiler);
+        else
+            answer_query(query, root, search_index, range_pool, outcome);
+        double millis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        size_t results = query.count_only ? outcome.count : outcome.doc_ids.size();
+        outcome.plan = plan_report(query, "profile", plan, search_index, per_node ? &profiler : nullptr, millis, results);
+        return outcome;
     }
 
-    cout << "Total queries parsed: " << queries.size() << endl;
-    return queries;
+    answer_query(query, root, search_index, range_pool, outcome);
+    return outcome;
 }
 
-// Helper function to evaluate query tree using postings map
-vector<string> evaluate_tree_with_postings(QueryNode *root,
-                                           const map<string, vector<string>> &postings_map,
-                                           const vector<string> &universe)
+// k-way merge of the shards' sorted doc ID lists, mapped into the merged
+// name table (each shard's IDs map in ascending order), keeping the first limit
+DocList merge_shard_doc_ids(const vector<QueryOutcome> &parts, size_t limit)
 {
-    if (!root)
-        return {};
+    typedef pair<uint32_t, size_t> Head; // (merged doc ID, shard)
+    priority_queue<Head, vector<Head>, greater<Head>> heads;
+    vector<size_t> next(parts.size(), 0);
+    for (size_t k = 0; k < parts.size(); k++)
+    {
+        if (!parts[k].doc_ids.empty())
+            heads.push(Head(global_shards[k].merged_doc_ids[parts[k].doc_ids[0]], k));
+    }
+
+    DocList merged;
+    while (!heads.empty() && merged.size() < limit)
+    {
+        Head head = heads.top();
+        heads.pop();
+        merged.push_back(head.first);
+        size_t k = head.second;
+        if (++next[k] < parts[k].doc_ids.size())
+            heads.push(Head(global_shards[k].merged_doc_ids[parts[k].doc_ids[next[k]]], k));
+    }
+    return merged;
+}
+
+// Combine the outcomes of one query on every shard: counts add up, ranked
+// lists merge by score (shards score with the collection's BM25 statistics),
+// Boolean lists merge in doc name order; plan reports are concatenated
+QueryOutcome merge_shard_outcomes(const QueryRequest &query, const vector<QueryOutcome> &parts)
+{
+    QueryOutcome merged;
+    for (const QueryOutcome &part : parts)
+    {
+        merged.parsed = merged.parsed && part.parsed;
+        merged.count += part.count;
+        merged.plan += part.plan;
+    }
+    merged.count = min(merged.count, query.limit);
+    if (!merged.parsed || query.explain || query.count_only)
+        return merged;
+
+    if (!global_options.ranked)
+    {
+        merged.doc_ids = merge_shard_doc_ids(parts, query.limit);
+        return merged;
+    }
 
-    if (!is_operator(root->value))
+    vector<pair<double, uint32_t>> results;
+    for (size_t k = 0; k < parts.size(); k++)
     {
-        // Leaf node (term)
-        auto it = postings_map.find(root->value);
-        if (it != postings_map.end())
+        for (size_t i = 0; i < parts[k].doc_ids.size(); i++)
         {
-            return it->second; // Already sorted
+            results.push_back(make_pair(parts[k].scores[i], global_shards[k].merged_doc_ids[parts[k].doc_ids[i]]));
         }
-        else
+    }
+    sort(results.begin(), results.end(), BetterResult());
+    results.resize(min(results.size(), min(global_options.top_k, query.limit)));
+    for (const auto &result : results)
+    {
+        merged.doc_ids.push_back(result.second);
+        merged.scores.push_back(result.first);
+    }
+    return merged;
+}
+
+// Evaluate one query on every shard, concurrently on shard_pool if given,
+// and merge the results into doc IDs of the merged name table
+QueryOutcome run_sharded_query(const QueryRequest &query, const WordTable &stopwords, WorkStealingPool *shard_pool)
+{
+    vector<QueryOutcome> parts(global_shards.size());
+    auto run_shard = [&](size_t k)
+    { parts[k] = run_query(query, stopwords, global_shards[k]); };
+    if (shard_pool)
+    {
+        shard_pool->start(parts.size(), run_shard);
+        shard_pool->wait();
+    }
+    else
+    {
+        for (size_t k = 0; k < parts.size(); k++)
         {
-            return {}; // Term not found, return empty set
+            run_shard(k);
         }
     }
+    return merge_shard_outcomes(query, parts);
+}
+
+// Evaluate one query on the loaded index: on every shard of a sharded index
+// (pool fans the shards out), else on search_index (pool splits doc ID ranges)
+QueryOutcome evaluate_request(const QueryRequest &query, const WordTable &stopwords, const SearchIndex &search_index,
+                              WorkStealingPool *pool)
+{
+    if (!global_shards.empty())
+        return run_sharded_query(query, stopwords, pool);
+    return run_query(query, stopwords, search_index, pool);
+}
+
+// Write one query's results to the result sink (count-only queries write
+// their match count to the count sink instead); EXPLAIN / PROFILE reports go
+// to the plan sink, and an explained query writes nothing else
+void write_query_results(ResultSink &results, ResultSink &counts, ResultSink &plans, const QueryRequest &query,
+                         const QueryOutcome &outcome, const SearchIndex &search_index)
+{
+    const string &qid = query.qid;
+    if (!outcome.parsed)
+    {
+        cerr << "Warning: Failed to parse query " << qid << ": \"" << query.title << "\", skipping." << endl;
+        return;
+    }
 
-    // Internal node (operator)
-    vector<string> left_result = evaluate_tree_with_postings(root->left, postings_map, universe);
-    vector<string> right_result = evaluate_tree_with_postings(root->right, postings_map, universe);
+    if (!outcome.plan.empty())
+        plans.write_text(outcome.plan);
+    if (query.explain)
+        return;
 
-    if (root->value == "AND")
+    if (query.count_only)
     {
-        vector<string> result;
-        set_intersection(left_result.begin(), left_result.end(),
-                         right_result.begin(), right_result.end(),
-                         back_inserter(result));
-        return result;
+        counts.write_count(qid, outcome.count);
+        return;
     }
-    else if (root->value == "OR")
+
+    // Ranked results come in rank order; Boolean doc IDs follow document name
+    // order, so the names come out lexicographically sorted (an index built
+    // in memory is sorted by name here instead)
+    const DocList *doc_ids = &outcome.doc_ids;
+    DocList by_name;
+    if (outcome.scores.empty() && !search_index.names_sorted)
     {
-        vector<string> result;
-        set_union(left_result.begin(), left_result.end(),
-                  right_result.begin(), right_result.end(),
-                  back_inserter(result));
-        return result;
+        by_name = outcome.doc_ids;
+        sort(by_name.begin(), by_name.end(), [&](uint32_t a, uint32_t b)
+             { return search_index.doc_names[a] < search_index.doc_names[b]; });
+        doc_ids = &by_name;
     }
-    else if (root->value == "NOT")
+
+    results.begin_query(qid, doc_ids->size());
+    for (size_t i = 0; i < doc_ids->size(); i++)
     {
-        // NOT operator - universe minus right operand
-        vector<string> result;
-        set_difference(universe.begin(), universe.end(),
-                       right_result.begin(), right_result.end(),
-                       back_inserter(result));
-        return result;
+        uint32_t doc_id = (*doc_ids)[i];
+        double score = outcome.scores.empty() ? 1.0 : outcome.scores[i];
+        results.write_result(qid, doc_id, search_index.doc_names[doc_id], i + 1, score); // 1-based ranking
     }
+}
+
+// Server mode: read one query per line from standard input (a JSON object
+// with query_id and title, or a bare title) and answer it on standard output
+// right away, flushing after each query
+void serve_queries(const WordTable &stopwords, const SearchIndex &search_index,
+                   WorkStealingPool *range_pool)
+{
+    ResultSink results(global_options.format, global_options.ranked, false);
+    results.open("-");
+
+    // EXPLAIN / PROFILE reports share standard output with text results;
+    // binary results keep it to themselves, the reports going to stderr
+    bool binary = global_options.format == FORMAT_BINARY;
+    ResultSink plan_sink(FORMAT_DOCIDS, false, false);
+    if (binary)
+        plan_sink.open(stderr);
+    ResultSink &plans = binary ? plan_sink : results;
+
+    string line;
+    size_t line_count = 0;
+    while (getline(cin, line))
+    {
+        line_count++;
+        line.erase(0, line.find_first_not_of(" \t"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (line.empty())
+            continue;
+
+        QueryRequest query(to_string(line_count), line);
+        if (line[0] == '{')
+        {
+            query.qid.clear();
+            query.title.clear();
+            parse_query_line(line, query);
+        }
 
-    return {};
+        write_query_results(results, results, plans, query,
+                            evaluate_request(query, stopwords, search_index, range_pool), search_index);
+        results.flush();
+        plans.flush();
+    }
 }
 
 // Main boolean retrieval function as required by assignment (Task 4.4)
@@ -1043,103 +3423,219 @@ void boolean_retrieval(
     const string &path_to_query_file,
     const string &output_dir)
 {
-    // Load stopwords
-    unordered_set<string> stopwords = load_stopwords_with_fallback(output_dir);
+    // Shared read-only search index (compressed postings with skip tables)
+    SearchIndex fallback_index;
+    const SearchIndex &search_index = select_search_index(inverted_index, fallback_index);
+
+    // Query analyzer: the one saved with the index, or for indexes without
+    // analyzer.bin the stopwords.txt found near the output directory
+    WordTable probed_stopwords;
+    if (!search_index.has_analyzer)
+    {
+        cerr << "Warning: Index has no usable analyzer.bin; looking for stopwords.txt instead" << endl;
+        probed_stopwords = load_stopwords_with_fallback(output_dir);
+    }
+    const WordTable &stopwords = search_index.has_analyzer ? search_index.analyzer : probed_stopwords;
+
+    // Intra-query parallelism, for when queries are evaluated one at a time:
+    // doc ID ranges of expensive queries, or the shards of a sharded index
+    // (by default one thread per shard, up to the core count)
+    unsigned threads = resolve_thread_count(global_options.threads);
+    unsigned query_threads = resolve_thread_count(global_options.query_threads);
+    if (!global_shards.empty() && global_options.query_threads == 1)
+    {
+        query_threads = min(resolve_thread_count(0), (unsigned)global_shards.size());
+    }
+    unique_ptr<WorkStealingPool> range_pool;
+    if (query_threads > 1 && (threads <= 1 || path_to_query_file == "-"))
+    {
+        range_pool.reset(new WorkStealingPool(query_threads));
+    }
 
-    // Load queries
-    vector<pair<string, string>> queries = parse_queries_file(path_to_query_file);
-    if (queries.empty())
+    // Server mode: answer queries from standard input as they arrive
+    if (path_to_query_file == "-")
     {
-        cerr << "No valid queries found in file: " << path_to_query_file << endl;
+        serve_queries(stopwords, search_index, range_pool.get());
         return;
     }
 
-    // Build postings_map: term → sorted vector<string> of docIDs
-    map<string, vector<string>> postings_map;
-    set<string> all_docs_set;
-
-    for (const auto &term_entry : inverted_index)
+    // Stream queries from the file: each one is evaluated as soon as it is
+    // read, so memory does not grow with the number of queries
+    QueryFileReader reader;
+    if (!reader.open(path_to_query_file))
     {
-        const string &term = term_entry.first;
-        vector<string> docs;
-
-        for (const auto &doc_entry : term_entry.second)
-        {
-            docs.push_back(doc_entry.first);
-            all_docs_set.insert(doc_entry.first);
-        }
-
-        sort(docs.begin(), docs.end());
-        postings_map[term] = docs;
+        cerr << "Warning: Cannot open query file: " << path_to_query_file << endl;
+    }
+    QueryRequest first_query;
+    if (!reader.next(first_query))
+    {
+        cerr << "No valid queries found in file: " << path_to_query_file << endl;
+        return;
     }
-
-    // Build universe: sorted vector<string> of all docIDs
-    vector<string> universe(all_docs_set.begin(), all_docs_set.end());
-    sort(universe.begin(), universe.end());
 
     // Create output directory if it doesn't exist
     create_directory_if_not_exists(output_dir);
 
-    // Open output file
-    string output_file_path = output_dir + "/docids.txt";
-    ofstream output_file(output_file_path);
-    if (!output_file.is_open())
+    // Output file (or standard output): a file is opened with the first
+    // query that writes doc IDs, so count-only runs leave no empty docids.txt
+    const char *extensions[] = {".txt", ".trec", ".bin"};
+    string output_file_path = global_options.to_stdout ? "-" : output_dir + "/docids" + extensions[global_options.format];
+    ResultSink output_file(global_options.format, global_options.ranked, global_options.async_output);
+    if (global_options.to_stdout && !output_file.open(output_file_path))
     {
         cerr << "Error: Cannot create output file: " << output_file_path << endl;
         return;
     }
-
-    // Process each query
-    for (const auto &query_pair : queries)
+    bool output_failed = false;
+
+    // Hit counts of count-only queries go to counts.txt, and EXPLAIN /
+    // PROFILE reports to plans.jsonl (one JSON object per line), each opened
+    // on first use; both share the output stream when text results go to
+    // standard output (counts also in the binary format)
+    bool inline_plans = global_options.to_stdout && global_options.format != FORMAT_BINARY;
+    ResultSink count_sink(FORMAT_DOCIDS, false, false);
+    ResultSink plan_sink(FORMAT_DOCIDS, false, false);
+    ResultSink &count_file = global_options.to_stdout ? output_file : count_sink;
+    ResultSink &plan_file = inline_plans ? output_file : plan_sink;
+    auto write_results = [&](const QueryRequest &query, const QueryOutcome &outcome)
     {
-        const string &qid = query_pair.first;
-        const string &title = query_pair.second;
+        if (query.count_only && !global_options.to_stdout && !count_sink.is_open())
+            count_sink.open(output_dir + "/counts.txt");
+        if ((query.explain || query.profile) && !inline_plans && !plan_sink.is_open())
+            plan_sink.open(output_dir + "/plans.jsonl");
+        bool writes_doc_ids = outcome.parsed && !query.explain && !query.count_only;
+        if (writes_doc_ids && !output_file.is_open() && !output_failed && !output_file.open(output_file_path))
+        {
+            cerr << "Error: Cannot create output file: " << output_file_path << endl;
+            output_failed = true;
+        }
+        if (writes_doc_ids && output_failed)
+            return;
+        write_query_results(output_file, count_file, plan_file, query, outcome, search_index);
+    };
 
-        // Preprocess query
-        vector<string> processed = preprocess_query(title, stopwords);
-        if (processed.empty())
+    if (threads <= 1)
+    {
+        // Process each query in order on this thread
+        QueryRequest query = first_query;
+        do
+        {
+            write_results(query, evaluate_request(query, stopwords, search_index, range_pool.get()));
+        } while (reader.next(query));
+    }
+    else
+    {
+        // Evaluate windows of queries on a work-stealing pool while this
+        // thread writes results through a reorder buffer in query order; the
+        // next window is read once the current one is done
+        WorkStealingPool pool(threads);
+        ReorderBuffer<QueryOutcome> reorder;
+        vector<QueryRequest> window(QUERY_BATCH_WINDOW);
+        window[0] = first_query;
+        size_t count = 1;
+
+        while (true)
         {
-            continue; // Skip empty queries
+            while (count < QUERY_BATCH_WINDOW && reader.next(window[count]))
+            {
+                count++;
+            }
+            if (count == 0)
+                break;
+
+            reorder.reset(count);
+            pool.start(count, [&](size_t i)
+                       { reorder.put(i, evaluate_request(window[i], stopwords, search_index, nullptr)); });
+            for (size_t i = 0; i < count; i++)
+            {
+                write_results(window[i], reorder.take(i));
+            }
+            pool.wait();
+            count = 0;
         }
+        status_stream() << "Evaluated " << reader.parsed() << " queries on " << threads << " threads." << endl;
+    }
+    status_stream() << "Total queries parsed: " << reader.parsed() << endl;
 
-        // Convert to postfix
-        vector<string> postfix = infix_to_postfix(processed);
+    bool wrote_doc_ids = output_file.is_open();
+    if (!output_file.close() || !count_sink.close() || !plan_sink.close() || output_failed)
+    {
+        cerr << "Error: Failed to write results to: " << output_file_path << endl;
+        return;
+    }
+    status_stream() << "Boolean retrieval completed. Results written to: "
+                    << (wrote_doc_ids ? output_file_path : output_dir) << endl;
+}
 
-        // Build tree
-        QueryNode *root = build_tree(postfix);
-        if (root == nullptr)
+// Parse optional "--name=value" / "--name value" settings after the required arguments
+bool parse_retrieval_options(int argc, char *argv[], int first, RetrievalOptions &options)
+{
+    for (int i = first; i < argc; i++)
+    {
+        string option = argv[i];
+        // Flags without a value
+        bool *flag = option == "--ranked"         ? &options.ranked
+                     : option == "--count-only"   ? &options.count_only
+                     : option == "--stdout"       ? &options.to_stdout
+                     : option == "--async-output" ? &options.async_output
+                     : option == "--explain"      ? &options.explain
+                     : option == "--profile"      ? &options.profile
+                                                  : nullptr;
+        if (flag)
         {
-            cerr << "Warning: Failed to parse query " << qid << ": \"" << title << "\", skipping." << endl;
+            *flag = true;
             continue;
         }
 
-        // Evaluate query
-        vector<string> results = evaluate_tree_with_postings(root, postings_map, universe);
-
-        // Sort results lexicographically (should already be sorted from set operations)
-        sort(results.begin(), results.end());
-
-        // Write 4-column format output: qid docid rank score
-        for (size_t i = 0; i < results.size(); i++)
+        string arg = option;
+        string value;
+        size_t eq = arg.find('=');
+        if (eq != string::npos)
         {
-            int rank = i + 1; // 1-based ranking
-            output_file << qid << " " << results[i] << " " << rank << " 1" << endl;
+            value = arg.substr(eq + 1);
+            arg = arg.substr(0, eq);
+        }
+        else if (i + 1 < argc)
+        {
+            value = argv[++i];
         }
 
-        // Clean up tree
-        delete root;
+        uint64_t number = 0;
+        if (arg == "--threads" && parse_unsigned(value, MAX_POOL_THREADS, number))
+        {
+            options.threads = number;
+        }
+        else if (arg == "--query-threads" && parse_unsigned(value, MAX_POOL_THREADS, number))
+        {
+            options.query_threads = number;
+        }
+        else if (arg == "--top-k" && parse_unsigned(value, SIZE_MAX, number) && number > 0)
+        {
+            options.top_k = number;
+        }
+        else if (arg == "--limit" && parse_unsigned(value, SIZE_MAX, number))
+        {
+            options.limit = number;
+        }
+        else if (arg == "--format" && (value == "docids" || value == "trec" || value == "binary"))
+        {
+            options.format = value == "docids" ? FORMAT_DOCIDS : value == "trec" ? FORMAT_TREC : FORMAT_BINARY;
+        }
+        else
+        {
+            cerr << "Error: Unknown or invalid option: " << option << endl;
+            return false;
+        }
     }
-
-    output_file.close();
-    cout << "Boolean retrieval completed. Results written to: " << output_file_path << endl;
+    return true;
 }
 
 // Main function as required by assignment
 int main(int argc, char *argv[])
 {
-    if (argc != 4)
+    if (argc < 4 || !parse_retrieval_options(argc, argv, 4, global_options))
     {
-        cerr << "Usage: " << argv[0] << " <COMPRESSED_DIR> <QUERY_FILE_PATH> <OUTPUT_DIR>" << endl;
+        cerr << "Usage: " << argv[0] << " <COMPRESSED_DIR> <QUERY_FILE_PATH|-> <OUTPUT_DIR> [--threads=N] [--query-threads=N] [--ranked [--top-k=N]] [--limit=N] [--count-only] [--format=docids|trec|binary] [--stdout] [--async-output] [--explain] [--profile]" << endl;
         return 1;
     }
 
@@ -1153,7 +3649,8 @@ int main(int argc, char *argv[])
     // Task 4.1: Decompress index
     auto index = decompress_index(compressed_dir);
 
-    if (index.empty())
+    // A sharded index is not decoded: only its shards' search structures load
+    if (index.empty() && global_shards.empty())
     {
         cerr << "Error: Failed to decompress index from " << compressed_dir << endl;
         return 1;
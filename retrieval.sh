@@ -1,11 +1,24 @@
 #!/bin/bash
 
 # retrieval.sh - Shell script for Task 4: Boolean Retrieval
-# Usage: ./retrieval.sh <COMPRESSED_DIR> <QUERY_FILE_PATH> <OUTPUT_DIR>
+# Usage: ./retrieval.sh <COMPRESSED_DIR> <QUERY_FILE_PATH> <OUTPUT_DIR> [OPTIONS...]
+# Options:
+#   --threads=N          Evaluate queries on N threads (0 = all cores, default 1)
+#   --query-threads=N    Split each expensive query over N threads
+#   --ranked             Rank by BM25 (top-k, real scores) instead of Boolean matching
+#   --top-k=N            Results per query in ranked mode (default 1000)
+#   --limit=N            Keep only the first N matches per query
+#   --count-only         Write match counts to counts.txt instead of documents
+#   --format=F           Result format: docids (default), trec or binary
+#   --stdout             Stream results to stdout instead of OUTPUT_DIR
+#   --async-output       Write result buffers on a background thread
+#   --explain            Write query plans to plans.jsonl instead of evaluating
+#   --profile            Also write plans with per-node costs to plans.jsonl
+# Pass "-" as QUERY_FILE_PATH to answer queries read from stdin on stdout
 
 # Check if correct number of arguments provided
-if [ $# -ne 3 ]; then
-    echo "Usage: $0 <COMPRESSED_DIR> <QUERY_FILE_PATH> <OUTPUT_DIR>"
+if [ $# -lt 3 ]; then
+    echo "Usage: $0 <COMPRESSED_DIR> <QUERY_FILE_PATH> <OUTPUT_DIR> [--threads=N] [--query-threads=N] [--ranked [--top-k=N]] [--limit=N] [--count-only] [--format=docids|trec|binary] [--stdout] [--async-output] [--explain] [--profile]"
     echo "Example: $0 /path/to/compressed_dir /path/to/queries.json /path/to/output_dir"
     exit 1
 fi
@@ -15,7 +28,7 @@ SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
 
 # Compile the C++ program
 echo "Compiling retrieval.cpp..."
-g++ -std=c++11 -o "${SCRIPT_DIR}/retrieval" "${SCRIPT_DIR}/retrieval.cpp"
+g++ -std=c++11 -pthread -o "${SCRIPT_DIR}/retrieval" "${SCRIPT_DIR}/retrieval.cpp"
 
 # Check if compilation was successful
 if [ $? -ne 0 ]; then
@@ -32,7 +45,7 @@ echo "  Query File Path: $2"
 echo "  Output Directory: $3"
 echo ""
 
-"${SCRIPT_DIR}/retrieval" "$1" "$2" "$3"
+"${SCRIPT_DIR}/retrieval" "$1" "$2" "$3" "${@:4}"
 
 # Check if execution was successful
 if [ $? -eq 0 ]; then
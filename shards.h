@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <cstdlib>
+#include <cstdint>
+using namespace std;
+
+// Manifest of a document-partitioned index, in the compressed directory
+const char *const SHARD_MANIFEST = "shards.json";
+
+// Seed of the document name hash that assigns documents to shards
+const uint64_t SHARD_HASH_SEED = 0x5A4D;
+
+// Upper limit of --shards, and of manifests retrieval accepts
+const uint32_t MAX_SHARDS = 4096;
+
+// Directory of shard k inside an index or compressed directory
+inline string shard_directory(const string &dir, uint32_t shard)
+{
+    return dir + "/shard_" + to_string(shard);
+}
+
+// shards.json: {"shard_count": N}; shard k is the complete compressed index
+// in the shard_k subdirectory
+inline void write_shard_manifest(const string &compressed_dir, uint32_t shards)
+{
+    ofstream out(compressed_dir + "/" + SHARD_MANIFEST);
+    out << "{\"shard_count\": " << shards << "}\n";
+}
+
+// Shard count of a compressed directory into shards: 0 if it holds a single
+// index (no manifest). False if the manifest is damaged or lists no shards
+// or more than MAX_SHARDS: such a directory cannot be loaded either way.
+inline bool read_shard_count(const string &compressed_dir, uint32_t &shards)
+{
+    shards = 0;
+    ifstream in(compressed_dir + "/" + SHARD_MANIFEST);
+    if (!in.is_open())
+        return true;
+    string content((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    size_t key = content.find("\"shard_count\"");
+    size_t colon = key == string::npos ? string::npos : content.find(':', key);
+    if (colon == string::npos)
+        return false;
+    const char *digits = content.c_str() + colon + 1;
+    char *end = nullptr;
+    unsigned long long count = strtoull(digits, &end, 10);
+    if (end == digits || count == 0 || count > MAX_SHARDS)
+        return false;
+    shards = count;
+    return true;
+}
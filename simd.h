@@ -0,0 +1,21 @@
+#pragma once
+// CPU feature detection for runtime dispatch of vectorized kernels.
+// Kernels are compiled with per-function target attributes, so the programs
+// still build with plain "g++ -std=c++11" and fall back to scalar code on
+// CPUs (or compilers) without the instruction sets.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// True if AVX2 kernels may be called on this CPU
+inline bool cpu_has_avx2()
+{
+#ifdef HAVE_X86_SIMD
+    static const bool supported = __builtin_cpu_supports("avx2") != 0;
+    return supported;
+#else
+    return false;
+#endif
+}
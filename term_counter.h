@@ -0,0 +1,147 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include "word_table.h"
+using namespace std;
+
+// Document and collection frequency of a term
+struct TermFrequency
+{
+    uint32_t df; // Documents containing the term
+    uint64_t cf; // Occurrences in the whole collection
+};
+
+// Open-addressing hash map from term to TermFrequency, for one thread's
+// share of the corpus. Terms live in one growing byte arena; slots hold the
+// full hash, so probes and rehashing compare bytes only on a hash match.
+// Linear probing over a power-of-two table kept at most 3/4 full.
+class TermCounter
+{
+public:
+    // A counted term; text points into the counter's arena (valid until the
+    // next add)
+    struct Term
+    {
+        const char *text;
+        uint32_t length;
+        TermFrequency frequency;
+
+        bool operator<(const Term &other) const
+        {
+            int order = memcmp(text, other.text, min(length, other.length));
+            return order != 0 ? order < 0 : length < other.length;
+        }
+    };
+
+    TermCounter() : count_(0) { slots_.resize(INITIAL_SLOTS); }
+
+    // Count one occurrence of token in document doc (documents are numbered
+    // by the caller and must be added one at a time: df rises once per doc)
+    void add(const string &token, uint64_t doc)
+    {
+        Slot &slot = find_or_insert(token.data(), token.size(), word_hash(token.data(), token.size(), HASH_SEED));
+        slot.frequency.cf++;
+        if (slot.last_doc != doc)
+        {
+            slot.last_doc = doc;
+            slot.frequency.df++;
+        }
+    }
+
+    // Add the counts of another counter (documents never span two counters)
+    void merge(const TermCounter &other)
+    {
+        for (const Slot &from : other.slots_)
+        {
+            if (from.length == EMPTY)
+                continue;
+            const char *text = other.arena_.data() + from.offset;
+            Slot &slot = find_or_insert(text, from.length, from.hash);
+            slot.frequency.df += from.frequency.df;
+            slot.frequency.cf += from.frequency.cf;
+        }
+    }
+
+    size_t size() const { return count_; }
+
+    // All terms in lexicographic (byte) order
+    vector<Term> sorted_terms() const
+    {
+        vector<Term> terms;
+        terms.reserve(count_);
+        for (const Slot &slot : slots_)
+        {
+            if (slot.length != EMPTY)
+                terms.push_back(Term{arena_.data() + slot.offset, slot.length, slot.frequency});
+        }
+        sort(terms.begin(), terms.end());
+        return terms;
+    }
+
+private:
+    static const uint32_t EMPTY = UINT32_MAX; // Length of an unused slot
+    static const size_t INITIAL_SLOTS = 1 << 12;
+    static const uint64_t HASH_SEED = 0x7E2C;
+
+    struct Slot
+    {
+        uint64_t hash;
+        uint64_t last_doc; // Last document counted in df
+        uint32_t offset;   // Start of the term in arena_
+        uint32_t length;
+        TermFrequency frequency;
+
+        Slot() : hash(0), last_doc(UINT64_MAX), offset(0), length(EMPTY), frequency{0, 0} {}
+    };
+
+    Slot &find_or_insert(const char *text, size_t length, uint64_t hash)
+    {
+        size_t mask = slots_.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            Slot &slot = slots_[i];
+            if (slot.length == EMPTY)
+            {
+                if (4 * (count_ + 1) > 3 * slots_.size())
+                {
+                    grow();
+                    return find_or_insert(text, length, hash);
+                }
+                slot.hash = hash;
+                slot.offset = arena_.size();
+                slot.length = length;
+                arena_.append(text, length);
+                count_++;
+                return slot;
+            }
+            if (slot.hash == hash && slot.length == length && memcmp(arena_.data() + slot.offset, text, length) == 0)
+                return slot;
+        }
+    }
+
+    // Double the table; stored hashes place every slot without rehashing
+    void grow()
+    {
+        vector<Slot> old(slots_.size() * 2);
+        old.swap(slots_);
+        size_t mask = slots_.size() - 1;
+        for (const Slot &slot : old)
+        {
+            if (slot.length == EMPTY)
+                continue;
+            size_t i = slot.hash & mask;
+            while (slots_[i].length != EMPTY)
+            {
+                i = (i + 1) & mask;
+            }
+            slots_[i] = slot;
+        }
+    }
+
+    vector<Slot> slots_;
+    string arena_; // Term bytes, appended on first sight
+    size_t count_;
+};
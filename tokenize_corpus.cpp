@@ -1,6 +1,4 @@
 #include <iostream>
-#include <unordered_set>
-#include <set>
 #include <vector>
 #include <string>
 #include <fstream>
@@ -16,6 +14,10 @@
 #endif
 #include "tokenizer.h"
 #include "utilities.h"
+#include "parallel.h"
+#include "term_counter.h"
+#include "vocabulary.h"
+#include "line_reader.h"
 
 using namespace std;
 
@@ -40,6 +42,102 @@ bool copy_file(const string &source, const string &destination)
     return true;
 }
 
+// Worker threads for vocabulary extraction (0 = one per hardware thread)
+unsigned global_vocab_threads = 0;
+
+// Set when a corpus file could not be read completely; no vocabulary is written
+bool global_corpus_failed = false;
+
+// Vocabulary pruning: drop terms found in fewer than min_df documents, or in
+// more than max_df_fraction of all documents
+struct PruneOptions
+{
+    uint32_t min_df;
+    double max_df_fraction;
+
+    PruneOptions() : min_df(1), max_df_fraction(1.0) {}
+};
+
+PruneOptions global_prune_options;
+
+// Remove the terms the prune options reject, keeping the order
+size_t prune_terms(vector<TermCounter::Term> &terms, uint64_t doc_count, const PruneOptions &options)
+{
+    double max_df = options.max_df_fraction * doc_count;
+    size_t kept = 0;
+    for (const TermCounter::Term &term : terms)
+    {
+        if (term.frequency.df >= options.min_df && term.frequency.df <= max_df)
+            terms[kept++] = term;
+    }
+    size_t pruned = terms.size() - kept;
+    terms.resize(kept);
+    return pruned;
+}
+
+// Lines read from a corpus file before the workers are handed a batch, and
+// the byte budget that ends a batch early
+const size_t VOCAB_BATCH_LINES = 4096;
+const size_t VOCAB_BATCH_BYTES = 8 << 20;
+
+// A batch of corpus lines; line i is document first_doc + i
+struct LineBatch
+{
+    vector<string> lines;
+    size_t count;
+    uint64_t first_doc;
+
+    LineBatch() : count(0), first_doc(0) {}
+};
+
+// Read the next batch of lines of a corpus file (reusing the line buffers);
+// false at end of file
+bool read_line_batch(LineReader &file, LineBatch &batch, uint64_t first_doc)
+{
+    batch.count = 0;
+    batch.first_doc = first_doc;
+    size_t bytes = 0;
+    while (batch.count < VOCAB_BATCH_LINES && bytes < VOCAB_BATCH_BYTES)
+    {
+        if (batch.count == batch.lines.size())
+            batch.lines.push_back(string());
+        if (!file.next_line(batch.lines[batch.count]))
+            break;
+        bytes += batch.lines[batch.count].size();
+        batch.count++;
+    }
+    return batch.count > 0;
+}
+
+// Tokenize lines [begin, end) of a batch into one slice's counter; returns
+// the number of invalid lines
+size_t count_batch_terms(const LineBatch &batch, size_t begin, size_t end, const WordTable &stopwords,
+                         TermCounter &counter, size_t &documents)
+{
+    size_t invalid = 0;
+    string word; // Token buffer reused across documents
+    for (size_t i = begin; i < end; i++)
+    {
+        const string &json_line = batch.lines[i];
+        if (json_line.empty())
+            continue;
+
+        // Parse JSON document
+        Document doc = parse_json_document(json_line);
+        if (doc.doc_id.empty() || doc.content.empty())
+        {
+            invalid++;
+            continue;
+        }
+
+        uint64_t doc_number = batch.first_doc + i;
+        tokenize_each(doc.content.data(), doc.content.size(), stopwords, word, [&](const string &token)
+                      { counter.add(token, doc_number); });
+        documents++;
+    }
+    return invalid;
+}
+
 // Main function as required by the assignment
 void build_vocab(string corpus_dir, string stopwords_file, string vocab_dir)
 {
@@ -64,9 +162,6 @@ void build_vocab(string corpus_dir, string stopwords_file, string vocab_dir)
         cerr << "Warning: Failed to copy stopwords file to: " << stopwords_destination << endl;
     }
 
-    // Build vocabulary from JSON corpus
-    set<string> vocab;
-
     // Get all files in the corpus directory
     vector<string> corpus_files = get_files_in_directory(corpus_dir);
 
@@ -76,68 +171,143 @@ void build_vocab(string corpus_dir, string stopwords_file, string vocab_dir)
         return;
     }
 
-    int doc_count = 0;
+    // The main thread reads the next batch of lines while the workers
+    // tokenize the current one, each slice into its own hash counter; the
+    // counters are merged and sorted once at the end
+    WorkStealingPool pool(resolve_thread_count(global_vocab_threads));
+    size_t slices = pool.size();
+    vector<TermCounter> counters(slices);
+    vector<size_t> slice_documents(slices, 0), slice_invalid(slices, 0);
+    LineBatch batches[2];
+    uint64_t next_doc = 0;
+
     // Process each file in the corpus directory
     for (const string &corpus_file_path : corpus_files)
     {
         cout << "Processing corpus file: " << corpus_file_path << endl;
         
-        // Open the corpus file
-        ifstream corpus_file(corpus_file_path);
-        if (!corpus_file.is_open())
+        // Open the corpus file (gzip / zstd files stream through a decompressor)
+        LineReader corpus_file;
+        if (!corpus_file.open(corpus_file_path))
         {
+            // A compressed file whose decompressor cannot start is lost input
+            if (corpus_file.compression() != COMPRESSION_NONE)
+            {
+                cerr << "Error: Cannot start decompressor for corpus file: " << corpus_file_path << endl;
+                global_corpus_failed = true;
+                return;
+            }
             cerr << "Warning: Cannot open corpus file: " << corpus_file_path << ", skipping" << endl;
             continue;
         }
 
-        string json_line;
-        while (getline(corpus_file, json_line))
+        int current = 0;
+        bool more = read_line_batch(corpus_file, batches[current], next_doc);
+        while (more)
         {
-            if (json_line.empty())
-                continue;
+            const LineBatch &batch = batches[current];
+            next_doc += batch.count;
+            size_t chunk = (batch.count + slices - 1) / slices;
+            pool.start(slices, [&, chunk](size_t k)
+                       {
+                           size_t begin = min(batch.count, k * chunk), end = min(batch.count, begin + chunk);
+                           slice_invalid[k] = count_batch_terms(batch, begin, end, stopwords, counters[k],
+                                                                slice_documents[k]);
+                       });
+            current ^= 1;
+            more = read_line_batch(corpus_file, batches[current], next_doc);
+            pool.wait();
 
-            // Parse JSON document
-            Document doc = parse_json_document(json_line);
-            if (doc.doc_id.empty() || doc.content.empty())
+            for (size_t k = 0; k < slices; k++)
             {
-                cerr << "Warning: Skipping invalid JSON line in file: " << corpus_file_path << endl;
-                continue;
+                for (size_t n = 0; n < slice_invalid[k]; n++)
+                {
+                    cerr << "Warning: Skipping invalid JSON line in file: " << corpus_file_path << endl;
+                }
             }
+        }
+        if (!corpus_file.close())
+        {
+            // Truncated or damaged: the statistics would cover partial input
+            cerr << "Error: Failed to decompress corpus file: " << corpus_file_path << endl;
+            global_corpus_failed = true;
+            return;
+        }
+    }
 
-            // Tokenize the content
-            vector<string> tokens = tokenize(doc.content, stopwords);
-            vocab.insert(tokens.begin(), tokens.end());
-            doc_count++;
+    size_t doc_count = 0;
+    for (size_t k = 0; k < slices; k++)
+    {
+        doc_count += slice_documents[k];
+        if (k > 0)
+        {
+            counters[0].merge(counters[k]);
+            counters[k] = TermCounter();
         }
-        corpus_file.close();
     }
+    vector<TermCounter::Term> vocab = counters[0].sorted_terms();
+    size_t pruned = prune_terms(vocab, doc_count, global_prune_options);
 
-    // Save vocabulary to vocab.txt
+    // Save vocabulary to vocab.txt, df / cf per term to term_stats.txt, and
+    // both to vocab.bin for build_index
     string vocab_file_path = vocab_dir + "/vocab.txt";
+    string stats_file_path = vocab_dir + "/term_stats.txt";
+    string binary_file_path = vocab_dir + "/vocab.bin";
     ofstream out(vocab_file_path);
-    if (!out.is_open())
+    ofstream stats_out(stats_file_path);
+    if (!out.is_open() || !stats_out.is_open())
     {
-        cerr << "Error: Cannot create vocab file: " << vocab_file_path << endl;
+        cerr << "Error: Cannot create vocab file: " << (out.is_open() ? stats_file_path : vocab_file_path) << endl;
         return;
     }
 
-    for (const string &word : vocab)
+    for (const TermCounter::Term &term : vocab)
     {
-        out << word << "\n";
+        out.write(term.text, term.length);
+        out << "\n";
+        stats_out.write(term.text, term.length);
+        stats_out << ' ' << term.frequency.df << ' ' << term.frequency.cf << "\n";
     }
     out.close();
+    stats_out.close();
+    write_vocabulary_file(binary_file_path, doc_count, vocab);
 
     cout << "Vocabulary created from " << doc_count << " documents with " << vocab.size() << " unique tokens." << endl;
+    if (pruned > 0)
+        cout << "Pruned " << pruned << " terms by document frequency." << endl;
     cout << "Files created:" << endl;
     cout << "  - " << vocab_file_path << endl;
+    cout << "  - " << stats_file_path << " (term, document frequency, collection frequency)" << endl;
+    cout << "  - " << binary_file_path << " (binary vocabulary with the same statistics)" << endl;
     cout << "  - " << stopwords_destination << endl;
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 4)
+    bool options_ok = argc >= 4;
+    for (int i = 4; i < argc && options_ok; i++)
+    {
+        string option = argv[i];
+        size_t eq = option.find('=');
+        string name = option.substr(0, eq);
+        string value = eq == string::npos ? "" : option.substr(eq + 1);
+        uint64_t number = 0;
+        bool fraction = !value.empty() && value.find_first_not_of("0123456789.") == string::npos &&
+                        value.find('.') == value.rfind('.') && value != ".";
+        if (name == "--threads" && parse_unsigned(value, MAX_POOL_THREADS, number))
+            global_vocab_threads = number;
+        else if (name == "--min-df" && parse_unsigned(value, UINT32_MAX, number))
+            global_prune_options.min_df = number;
+        else if (name == "--max-df" && fraction && strtod(value.c_str(), nullptr) > 0 &&
+                 strtod(value.c_str(), nullptr) <= 1)
+            global_prune_options.max_df_fraction = strtod(value.c_str(), nullptr);
+        else
+            options_ok = false;
+    }
+    if (!options_ok)
     {
-        cerr << "Usage: " << argv[0] << " <corpus_dir> <stopwords_file> <vocab_dir>" << endl;
+        cerr << "Usage: " << argv[0] << " <corpus_dir> <stopwords_file> <vocab_dir>"
+             << " [--threads=N] [--min-df=N] [--max-df=FRACTION]" << endl;
         return 1;
     }
 
@@ -148,5 +318,5 @@ int main(int argc, char *argv[])
     // Call the build_vocab function with the required signature
     build_vocab(corpus_dir, stopwords_file, vocab_dir);
 
-    return 0;
+    return global_corpus_failed ? 1 : 0;
 }
@@ -1,11 +1,15 @@
 #!/bin/bash
 
 # tokenize_corpus.sh - Shell script for Task 1: Custom Tokenizer
-# Usage: ./tokenize_corpus.sh <CORPUS_DIR> <STOPWORDS_FILE> <VOCAB_DIR>
+# Usage: ./tokenize_corpus.sh <CORPUS_DIR> <STOPWORDS_FILE> <VOCAB_DIR> [OPTIONS...]
+# Options:
+#   --threads=N            Count terms on N threads (0 = one per core, the default)
+#   --min-df=N             Drop terms found in fewer than N documents
+#   --max-df=FRACTION      Drop terms found in more than FRACTION of all documents
 
 # Check if correct number of arguments provided
-if [ $# -ne 3 ]; then
-    echo "Usage: $0 <CORPUS_DIR> <STOPWORDS_FILE> <VOCAB_DIR>"
+if [ $# -lt 3 ]; then
+    echo "Usage: $0 <CORPUS_DIR> <STOPWORDS_FILE> <VOCAB_DIR> [--threads=N] [--min-df=N] [--max-df=FRACTION]"
     echo "Example: $0 /path/to/corpus /path/to/stopwords.txt /path/to/vocab_dir"
     exit 1
 fi
@@ -15,7 +19,7 @@ SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
 
 # Compile the C++ program
 echo "Compiling tokenize_corpus.cpp..."
-g++ -std=c++11 -o "${SCRIPT_DIR}/tokenize_corpus" "${SCRIPT_DIR}/tokenize_corpus.cpp"
+g++ -std=c++11 -pthread -o "${SCRIPT_DIR}/tokenize_corpus" "${SCRIPT_DIR}/tokenize_corpus.cpp"
 
 # Check if compilation was successful
 if [ $? -ne 0 ]; then
@@ -32,7 +36,7 @@ echo "  Stopwords File: $2"
 echo "  Vocabulary Directory: $3"
 echo ""
 
-"${SCRIPT_DIR}/tokenize_corpus" "$1" "$2" "$3"
+"${SCRIPT_DIR}/tokenize_corpus" "$1" "$2" "$3" "${@:4}"
 
 # Check if execution was successful
 if [ $? -eq 0 ]; then
@@ -1,37 +1,341 @@
 #pragma once
 #include <string>
 #include <vector>
-#include <unordered_set>
-#include <sstream>
-#include <cctype>
+#include <cstring>
+#include <cstdint>
+#include "simd.h"
+#include "word_table.h"
+#include "utf8.h"
 using namespace std;
 
-inline vector<string> tokenize(const string &text, const unordered_set<string> &stopwords)
+// Bytes classified per SIMD block (one AVX2 register)
+const size_t TOKEN_BLOCK = 32;
+
+// Byte tables of the tokenizer for ASCII: separators (whitespace and digits)
+// and the lowercase form of every other byte. Bytes from 0x80 up start UTF-8
+// sequences and are classified per code point instead (fold_char).
+struct TokenTable
+{
+    bool separator[128];
+    unsigned char fold[128];
+
+    TokenTable()
+    {
+        for (int c = 0; c < 128; c++)
+        {
+            separator[c] = (c >= '0' && c <= '9') || (c >= '\t' && c <= '\r') || c == ' ';
+            fold[c] = c >= 'A' && c <= 'Z' ? c + 32 : c;
+        }
+    }
+};
+
+inline const TokenTable &token_table()
+{
+    static const TokenTable table;
+    return table;
+}
+
+// Finish the token collected in word
+template <typename Emit>
+inline void finish_token(const string &word, const WordTable &stopwords, Emit &emit)
+{
+    if (!stopwords.is_stopword(word))
+        emit(word);
+}
+
+// Step over the character at text[i] (i < length): true if it belongs to a
+// token, its case-folded UTF-8 form then appended to word; false for a
+// separator (whitespace or a decimal digit, ASCII or Unicode). Bytes that do
+// not start a valid UTF-8 sequence are token characters, kept as they are.
+inline bool fold_char(const char *text, size_t length, size_t &i, string &word)
+{
+    unsigned char c = text[i];
+    if (c < 0x80)
+    {
+        const TokenTable &table = token_table();
+        i++;
+        if (table.separator[c])
+            return false;
+        word += (char)table.fold[c];
+        return true;
+    }
+
+    uint32_t code;
+    size_t n = decode_utf8(text + i, length - i, code);
+    if (n == 0)
+    {
+        i++;
+        word += (char)c;
+        return true;
+    }
+    i += n;
+    if (is_unicode_space(code) || is_unicode_digit(code))
+        return false;
+    append_utf8(fold_code_point(code), word);
+    return true;
+}
+
+// Code point loop over text[i, stop) (continuing to the end of a character
+// that crosses stop), with the open token carried in in_token / word;
+// returns the position reached
+template <typename Emit>
+inline size_t scan_unicode(const char *text, size_t length, size_t i, size_t stop, bool &in_token, string &word,
+                           const WordTable &stopwords, Emit &emit)
 {
-    string s = text;
-    // Lowercase and remove digits
-    for (char &c : s)
+    while (i < stop)
     {
-        if (isdigit(c))
+        if (!in_token)
         {
-            c = ' ';
+            word.clear();
+            in_token = fold_char(text, length, i, word);
         }
-        else
+        else if (!fold_char(text, length, i, word))
         {
-            c = tolower(c);
+            in_token = false;
+            finish_token(word, stopwords, emit);
         }
     }
+    return i;
+}
 
-    // Tokenize by whitespace
-    vector<string> tokens;
-    istringstream iss(s);
-    string token;
-    while (iss >> token)
+// Scalar tokenizer loop: table lookups per ASCII byte, the code point loop
+// for each non-ASCII character
+template <typename Emit>
+inline void tokenize_scalar(const char *text, size_t length, const WordTable &stopwords, string &word,
+                            Emit &emit)
+{
+    const TokenTable &table = token_table();
+    bool in_token = false;
+    size_t i = 0;
+    while (i < length)
+    {
+        unsigned char c = text[i];
+        if (c >= 0x80)
+        {
+            i = scan_unicode(text, length, i, i + 1, in_token, word, stopwords, emit);
+            continue;
+        }
+        i++;
+        if (table.separator[c])
+        {
+            if (in_token)
+            {
+                in_token = false;
+                finish_token(word, stopwords, emit);
+            }
+            continue;
+        }
+        if (!in_token)
+        {
+            word.clear();
+            in_token = true;
+        }
+        word += (char)table.fold[c];
+    }
+    if (in_token)
+        finish_token(word, stopwords, emit);
+}
+
+// Query word splitter: skip separators from text[i], fold the token that
+// follows into word and move i past it; false if none is left before length
+inline bool next_token(const char *text, size_t length, size_t &i, string &word)
+{
+    word.clear();
+    while (i < length && !fold_char(text, length, i, word))
+    {
+    }
+    while (i < length && fold_char(text, length, i, word))
+    {
+    }
+    return !word.empty();
+}
+
+// Emit the tokens of one classified block of width bytes: lowered holds the
+// block lowercased, bit i of separators marks separator byte i. Token
+// boundaries are found by counting trailing zeros of the shifted masks; a
+// token still open at the end of the block carries over in word.
+template <typename Emit>
+inline void scan_token_block(const char *lowered, uint32_t separators, unsigned width, bool &in_token, string &word,
+                             const WordTable &stopwords, Emit &emit)
+{
+    uint32_t full = width == 32 ? 0xFFFFFFFFu : (1u << width) - 1;
+    separators &= full;
+    uint32_t token_bytes = ~separators & full;
+    unsigned pos = 0;
+    while (pos < width)
+    {
+        if (!in_token)
+        {
+            uint32_t starts = token_bytes >> pos;
+            if (!starts)
+                return;
+            pos += __builtin_ctz(starts);
+            word.clear();
+            in_token = true;
+        }
+        uint32_t ends = separators >> pos;
+        if (!ends)
+        {
+            word.append(lowered + pos, width - pos);
+            return;
+        }
+        unsigned n = __builtin_ctz(ends);
+        word.append(lowered + pos, n);
+        pos += n;
+        in_token = false;
+        finish_token(word, stopwords, emit);
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+// Bytes of v in [lo, hi] (unsigned) as a byte mask
+SIMD_TARGET("avx2")
+inline __m256i byte_range_avx2(__m256i v, char lo, char hi)
+{
+    return _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(lo)), v),
+                            _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(hi)), v));
+}
+
+// Classify 32 bytes: store them lowercased, return the separator mask
+// (digits, \t..\r and space); non_ascii gets the mask of bytes >= 0x80
+SIMD_TARGET("avx2")
+inline uint32_t classify_block_avx2(const char *src, char *lowered, uint32_t &non_ascii)
+{
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+    non_ascii = (uint32_t)_mm256_movemask_epi8(v);
+    __m256i separators = _mm256_or_si256(_mm256_or_si256(byte_range_avx2(v, '0', '9'), byte_range_avx2(v, '\t', '\r')),
+                                         _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+    __m256i upper = byte_range_avx2(v, 'A', 'Z');
+    v = _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lowered), v);
+    return (uint32_t)_mm256_movemask_epi8(separators);
+}
+
+// AVX2 tokenizer loop: 32 bytes per step, the tail padded with spaces;
+// non-ASCII characters go through the code point loop one at a time
+template <typename Emit>
+SIMD_TARGET("avx2")
+inline void tokenize_avx2(const char *text, size_t length, const WordTable &stopwords, string &word,
+                          Emit &emit)
+{
+    char lowered[TOKEN_BLOCK];
+    char tail[TOKEN_BLOCK];
+    bool in_token = false;
+    for (size_t i = 0; i < length;)
+    {
+        const char *block = text + i;
+        if (i + TOKEN_BLOCK > length)
+        {
+            memset(tail, ' ', TOKEN_BLOCK);
+            memcpy(tail, text + i, length - i);
+            block = tail;
+        }
+        uint32_t non_ascii;
+        uint32_t separators = classify_block_avx2(block, lowered, non_ascii);
+        if (non_ascii)
+        {
+            // ASCII prefix as usual, then one character on the code point
+            // path; the next block starts right after it
+            unsigned prefix = __builtin_ctz(non_ascii);
+            scan_token_block(lowered, separators, prefix, in_token, word, stopwords, emit);
+            i = scan_unicode(text, length, i + prefix, i + prefix + 1, in_token, word, stopwords, emit);
+            continue;
+        }
+        scan_token_block(lowered, separators, TOKEN_BLOCK, in_token, word, stopwords, emit);
+        i += TOKEN_BLOCK;
+    }
+    if (in_token)
+        finish_token(word, stopwords, emit);
+}
+#endif
+
+#if defined(HAVE_X86_SIMD) && defined(__SSE2__)
+inline __m128i byte_range_sse2(__m128i v, char lo, char hi)
+{
+    return _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(lo)), v),
+                         _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(hi)), v));
+}
+
+// SSE2 version of classify_block_avx2 for 16 bytes
+inline uint32_t classify_block_sse2(const char *src, char *lowered, uint32_t &non_ascii)
+{
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    non_ascii = (uint32_t)_mm_movemask_epi8(v);
+    __m128i separators = _mm_or_si128(_mm_or_si128(byte_range_sse2(v, '0', '9'), byte_range_sse2(v, '\t', '\r')),
+                                      _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+    __m128i upper = byte_range_sse2(v, 'A', 'Z');
+    v = _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lowered), v);
+    return (uint32_t)_mm_movemask_epi8(separators);
+}
+
+// SSE2 tokenizer loop: two 16-byte halves per 32-byte mask
+template <typename Emit>
+inline void tokenize_sse2(const char *text, size_t length, const WordTable &stopwords, string &word,
+                          Emit &emit)
+{
+    char lowered[TOKEN_BLOCK];
+    char tail[TOKEN_BLOCK];
+    bool in_token = false;
+    for (size_t i = 0; i < length;)
     {
-        if (!stopwords.count(token) && !token.empty())
+        const char *block = text + i;
+        if (i + TOKEN_BLOCK > length)
         {
-            tokens.push_back(token);
+            memset(tail, ' ', TOKEN_BLOCK);
+            memcpy(tail, text + i, length - i);
+            block = tail;
         }
+        uint32_t low_non_ascii, high_non_ascii;
+        uint32_t separators = classify_block_sse2(block, lowered, low_non_ascii) |
+                              classify_block_sse2(block + 16, lowered + 16, high_non_ascii) << 16;
+        uint32_t non_ascii = low_non_ascii | high_non_ascii << 16;
+        if (non_ascii)
+        {
+            unsigned prefix = __builtin_ctz(non_ascii);
+            scan_token_block(lowered, separators, prefix, in_token, word, stopwords, emit);
+            i = scan_unicode(text, length, i + prefix, i + prefix + 1, in_token, word, stopwords, emit);
+            continue;
+        }
+        scan_token_block(lowered, separators, TOKEN_BLOCK, in_token, word, stopwords, emit);
+        i += TOKEN_BLOCK;
+    }
+    if (in_token)
+        finish_token(word, stopwords, emit);
+}
+#endif
+
+// Scan UTF-8 text[0, length) once and call emit(token) for every token that
+// is not a stopword. Tokens are runs of characters other than whitespace and
+// decimal digits, case-folded into word (caller-owned, so its capacity is
+// reused: no per-token allocation); the token passed to emit is only valid
+// until emit returns. Pure-ASCII 32-byte blocks run on SIMD (AVX2 if the CPU
+// has it, else SSE2); only blocks holding multi-byte characters take the
+// code point loop.
+template <typename Emit>
+inline void tokenize_each(const char *text, size_t length, const WordTable &stopwords, string &word,
+                          Emit emit)
+{
+#ifdef HAVE_X86_SIMD
+    if (cpu_has_avx2())
+    {
+        tokenize_avx2(text, length, stopwords, word, emit);
+        return;
     }
+#ifdef __SSE2__
+    tokenize_sse2(text, length, stopwords, word, emit);
+    return;
+#endif
+#endif
+    tokenize_scalar(text, length, stopwords, word, emit);
+}
+
+// Case-fold, split at whitespace and digits, drop stopwords
+inline vector<string> tokenize(const string &text, const WordTable &stopwords)
+{
+    vector<string> tokens;
+    string word;
+    tokenize_each(text.data(), text.size(), stopwords, word, [&tokens](const string &token)
+                  { tokens.push_back(token); });
     return tokens;
 }
@@ -0,0 +1,165 @@
+#pragma once
+#include <string>
+#include <algorithm>
+#include <cstdint>
+using namespace std;
+
+// Append a code point to a UTF-8 string
+inline void append_utf8(uint32_t code, string &out)
+{
+    if (code < 0x80)
+    {
+        out += (char)code;
+    }
+    else if (code < 0x800)
+    {
+        out += (char)(0xC0 | code >> 6);
+        out += (char)(0x80 | (code & 0x3F));
+    }
+    else if (code < 0x10000)
+    {
+        out += (char)(0xE0 | code >> 12);
+        out += (char)(0x80 | (code >> 6 & 0x3F));
+        out += (char)(0x80 | (code & 0x3F));
+    }
+    else
+    {
+        out += (char)(0xF0 | code >> 18);
+        out += (char)(0x80 | (code >> 12 & 0x3F));
+        out += (char)(0x80 | (code >> 6 & 0x3F));
+        out += (char)(0x80 | (code & 0x3F));
+    }
+}
+
+// Decode the UTF-8 sequence at the start of text[0, length) into code and
+// return its length; 0 if it is not a valid (shortest-form, non-surrogate)
+// sequence
+inline size_t decode_utf8(const char *text, size_t length, uint32_t &code)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(text);
+    unsigned char lead = bytes[0];
+    size_t n;
+    uint32_t smallest;
+    if (lead < 0x80)
+    {
+        code = lead;
+        return 1;
+    }
+    else if (lead >= 0xC2 && lead <= 0xDF)
+    {
+        n = 2;
+        code = lead & 0x1F;
+        smallest = 0x80;
+    }
+    else if (lead >= 0xE0 && lead <= 0xEF)
+    {
+        n = 3;
+        code = lead & 0x0F;
+        smallest = 0x800;
+    }
+    else if (lead >= 0xF0 && lead <= 0xF4)
+    {
+        n = 4;
+        code = lead & 0x07;
+        smallest = 0x10000;
+    }
+    else
+    {
+        return 0;
+    }
+    if (n > length)
+        return 0;
+    for (size_t k = 1; k < n; k++)
+    {
+        if ((bytes[k] & 0xC0) != 0x80)
+            return 0;
+        code = code << 6 | (bytes[k] & 0x3F);
+    }
+    if (code < smallest || code > 0x10FFFF || (code >= 0xD800 && code < 0xE000))
+        return 0;
+    return n;
+}
+
+// Inclusive code point range
+struct CodeRange
+{
+    uint32_t first, last;
+};
+
+// The range containing code, or nullptr (ranges sorted and disjoint)
+template <size_t N>
+inline const CodeRange *find_code_range(const CodeRange (&ranges)[N], uint32_t code)
+{
+    const CodeRange *it = upper_bound(ranges, ranges + N, code, [](uint32_t c, const CodeRange &range)
+                                      { return c < range.first; });
+    if (it == ranges || code > (it - 1)->last)
+        return nullptr;
+    return it - 1;
+}
+
+// Non-ASCII White_Space characters (NEL, no-break and typographic spaces,
+// line / paragraph separators, ideographic space)
+inline bool is_unicode_space(uint32_t code)
+{
+    static const CodeRange spaces[] = {{0x0085, 0x0085}, {0x00A0, 0x00A0}, {0x1680, 0x1680}, {0x2000, 0x200A},
+                                       {0x2028, 0x2029}, {0x202F, 0x202F}, {0x205F, 0x205F}, {0x3000, 0x3000}};
+    return find_code_range(spaces, code) != nullptr;
+}
+
+// Non-ASCII decimal digits (general category Nd) of the BMP scripts, plus
+// the mathematical alphanumeric digits
+inline bool is_unicode_digit(uint32_t code)
+{
+    static const CodeRange digits[] = {
+        {0x0660, 0x0669}, {0x06F0, 0x06F9}, {0x07C0, 0x07C9}, {0x0966, 0x096F}, {0x09E6, 0x09EF}, {0x0A66, 0x0A6F},
+        {0x0AE6, 0x0AEF}, {0x0B66, 0x0B6F}, {0x0BE6, 0x0BEF}, {0x0C66, 0x0C6F}, {0x0CE6, 0x0CEF}, {0x0D66, 0x0D6F},
+        {0x0DE6, 0x0DEF}, {0x0E50, 0x0E59}, {0x0ED0, 0x0ED9}, {0x0F20, 0x0F29}, {0x1040, 0x1049}, {0x1090, 0x1099},
+        {0x17E0, 0x17E9}, {0x1810, 0x1819}, {0x1946, 0x194F}, {0x19D0, 0x19D9}, {0x1A80, 0x1A89}, {0x1A90, 0x1A99},
+        {0x1B50, 0x1B59}, {0x1BB0, 0x1BB9}, {0x1C40, 0x1C49}, {0x1C50, 0x1C59}, {0xA620, 0xA629}, {0xA8D0, 0xA8D9},
+        {0xA900, 0xA909}, {0xA9D0, 0xA9D9}, {0xA9F0, 0xA9F9}, {0xAA50, 0xAA59}, {0xABF0, 0xABF9}, {0xFF10, 0xFF19},
+        {0x1D7CE, 0x1D7FF}};
+    return find_code_range(digits, code) != nullptr;
+}
+
+// Range of code points folded by adding delta; with step 2 only every other
+// one, starting at first (the upper case half of alternating case pairs)
+struct FoldRange
+{
+    uint32_t first, last;
+    int32_t delta;
+    uint32_t step;
+};
+
+// Simple case folding (CaseFolding.txt statuses C and S, plus U+0130 -> i)
+// for Latin, Greek, Cyrillic, Armenian and fullwidth Latin; other code
+// points are returned unchanged
+inline uint32_t fold_code_point(uint32_t code)
+{
+    static const FoldRange folds[] = {
+        {0x00B5, 0x00B5, 0x03BC - 0x00B5, 1}, {0x00C0, 0x00D6, 32, 1}, {0x00D8, 0x00DE, 32, 1},
+        {0x0100, 0x012E, 1, 2}, {0x0130, 0x0130, 0x0069 - 0x0130, 1}, {0x0132, 0x0136, 1, 2},
+        {0x0139, 0x0147, 1, 2}, {0x014A, 0x0176, 1, 2}, {0x0178, 0x0178, 0x00FF - 0x0178, 1},
+        {0x0179, 0x017D, 1, 2}, {0x017F, 0x017F, 0x0073 - 0x017F, 1}, {0x01CD, 0x01DB, 1, 2},
+        {0x01DE, 0x01EE, 1, 2}, {0x01F8, 0x021E, 1, 2}, {0x0222, 0x0232, 1, 2},
+        {0x0246, 0x024E, 1, 2}, {0x0386, 0x0386, 38, 1}, {0x0388, 0x038A, 37, 1},
+        {0x038C, 0x038C, 64, 1}, {0x038E, 0x038F, 63, 1}, {0x0391, 0x03A1, 32, 1},
+        {0x03A3, 0x03AB, 32, 1}, {0x03C2, 0x03C2, 1, 1}, {0x03CF, 0x03CF, 8, 1},
+        {0x03D0, 0x03D0, 0x03B2 - 0x03D0, 1}, {0x03D1, 0x03D1, 0x03B8 - 0x03D1, 1},
+        {0x03D5, 0x03D5, 0x03C6 - 0x03D5, 1}, {0x03D6, 0x03D6, 0x03C0 - 0x03D6, 1},
+        {0x03D8, 0x03EE, 1, 2}, {0x03F0, 0x03F0, 0x03BA - 0x03F0, 1}, {0x03F1, 0x03F1, 0x03C1 - 0x03F1, 1},
+        {0x03F4, 0x03F4, 0x03B8 - 0x03F4, 1}, {0x03F5, 0x03F5, 0x03B5 - 0x03F5, 1}, {0x03F7, 0x03F7, 1, 1},
+        {0x03F9, 0x03F9, 0x03F2 - 0x03F9, 1}, {0x03FA, 0x03FA, 1, 1}, {0x03FD, 0x03FF, -130, 1},
+        {0x0400, 0x040F, 80, 1}, {0x0410, 0x042F, 32, 1}, {0x0460, 0x0480, 1, 2},
+        {0x048A, 0x04BE, 1, 2}, {0x04C0, 0x04C0, 15, 1}, {0x04C1, 0x04CD, 1, 2},
+        {0x04D0, 0x052E, 1, 2}, {0x0531, 0x0556, 48, 1}, {0x1E00, 0x1E94, 1, 2},
+        {0x1E9E, 0x1E9E, 0x00DF - 0x1E9E, 1}, {0x1EA0, 0x1EFE, 1, 2}, {0xFF21, 0xFF3A, 32, 1}};
+    const FoldRange *it = upper_bound(folds, folds + sizeof(folds) / sizeof(folds[0]), code,
+                                      [](uint32_t c, const FoldRange &range)
+                                      { return c < range.first; });
+    if (it == folds)
+        return code;
+    --it;
+    if (code > it->last || (code - it->first) % it->step != 0)
+        return code;
+    return code + it->delta;
+}
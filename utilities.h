@@ -1,9 +1,12 @@
 #pragma once
 #include <string>
 #include <vector>
-#include <unordered_set>
 #include <fstream>
 #include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cerrno>
+#include "word_table.h"
 #ifdef _WIN32
 #include <windows.h>
 #include <direct.h>
@@ -14,6 +17,20 @@
 #endif
 using namespace std;
 
+// Parse a decimal option value in [0, max]; false for an empty value, other
+// characters or a number out of range (checked before any narrowing)
+inline bool parse_unsigned(const string &value, uint64_t max, uint64_t &result)
+{
+    if (value.empty() || value.find_first_not_of("0123456789") != string::npos)
+        return false;
+    errno = 0;
+    unsigned long long number = strtoull(value.c_str(), nullptr, 10);
+    if (errno == ERANGE || number > max)
+        return false;
+    result = number;
+    return true;
+}
+
 // Function to create directory if it doesn't exist (C++11 compatible)
 inline bool create_directory_if_not_exists(const string &path)
 {
@@ -87,14 +104,21 @@ inline vector<string> get_files_in_directory(const string &directory)
     return files;
 }
 
-// Load stopwords from file
-inline unordered_set<string> load_stopwords(const string &stopwords_file)
+// Add the whitespace-separated words of a stopwords file to a table
+inline void add_stopwords(WordTable &table, const string &stopwords_file)
 {
-    unordered_set<string> stopwords;
     ifstream file(stopwords_file);
     string word;
     while (file >> word)
-        stopwords.insert(word);
+        table.add(word, WORD_STOPWORD);
+}
+
+// Load stopwords from file into a perfect-hash table
+inline WordTable load_stopwords(const string &stopwords_file)
+{
+    WordTable stopwords;
+    add_stopwords(stopwords, stopwords_file);
+    stopwords.build();
     return stopwords;
 }
 
@@ -0,0 +1,85 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <utility>
+#include <cstdint>
+#include "term_counter.h"
+using namespace std;
+
+const uint32_t VOCABULARY_MAGIC = 0x42434F56; // "VOCB"
+const uint32_t VOCABULARY_VERSION = 1;
+
+// Limits accepted when reading vocab.bin
+const uint32_t VOCABULARY_MAX_TERM_BYTES = 1 << 20;
+
+// A term of vocab.bin with its collection statistics
+struct VocabularyEntry
+{
+    string term;
+    TermFrequency frequency;
+};
+
+// Contents of vocab.bin
+struct Vocabulary
+{
+    uint64_t doc_count; // Documents the statistics were counted over
+    vector<VocabularyEntry> terms;
+
+    Vocabulary() : doc_count(0) {}
+};
+
+// vocab.bin layout (little-endian): magic u32, version u32, doc_count u64,
+// term_count u32, then per term in byte order: length u32, df u32, cf u64
+// and the term's bytes
+inline void write_vocabulary_file(const string &path, uint64_t doc_count, const vector<TermCounter::Term> &terms)
+{
+    ofstream out(path, ios::binary);
+    uint32_t header[] = {VOCABULARY_MAGIC, VOCABULARY_VERSION};
+    uint32_t term_count = terms.size();
+    out.write(reinterpret_cast<const char *>(header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(&doc_count), sizeof(uint64_t));
+    out.write(reinterpret_cast<const char *>(&term_count), sizeof(uint32_t));
+    for (const TermCounter::Term &term : terms)
+    {
+        out.write(reinterpret_cast<const char *>(&term.length), sizeof(uint32_t));
+        out.write(reinterpret_cast<const char *>(&term.frequency.df), sizeof(uint32_t));
+        out.write(reinterpret_cast<const char *>(&term.frequency.cf), sizeof(uint64_t));
+        out.write(term.text, term.length);
+    }
+}
+
+// Read vocab.bin; false (vocabulary left empty) if missing, truncated or of
+// another version
+inline bool read_vocabulary_file(const string &path, Vocabulary &vocabulary)
+{
+    vocabulary = Vocabulary();
+    ifstream in(path, ios::binary);
+    uint32_t header[2], term_count = 0;
+    if (!in.read(reinterpret_cast<char *>(header), sizeof(header)) || header[0] != VOCABULARY_MAGIC ||
+        header[1] != VOCABULARY_VERSION ||
+        !in.read(reinterpret_cast<char *>(&vocabulary.doc_count), sizeof(uint64_t)) ||
+        !in.read(reinterpret_cast<char *>(&term_count), sizeof(uint32_t)))
+        return false;
+
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < term_count; i++)
+    {
+        VocabularyEntry entry;
+        uint32_t length = 0;
+        ok = in.read(reinterpret_cast<char *>(&length), sizeof(uint32_t)) &&
+             in.read(reinterpret_cast<char *>(&entry.frequency.df), sizeof(uint32_t)) &&
+             in.read(reinterpret_cast<char *>(&entry.frequency.cf), sizeof(uint64_t)) &&
+             length <= VOCABULARY_MAX_TERM_BYTES;
+        if (ok)
+        {
+            entry.term.resize(length);
+            ok = length == 0 || in.read(&entry.term[0], length);
+        }
+        if (ok)
+            vocabulary.terms.push_back(move(entry));
+    }
+    if (!ok)
+        vocabulary = Vocabulary();
+    return ok;
+}
@@ -0,0 +1,213 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cstdint>
+using namespace std;
+
+// Wildcard character of query terms (any run of characters, also none)
+const char WILDCARD = '*';
+
+// End-of-term marker of permuterm rotations; sorts before every term character
+const char PERMUTERM_END = '\0';
+
+// One rotation of a dictionary term: (term + END) rotated left by shift.
+// Rotations are not stored as strings; they are read through the term list.
+struct PermutermEntry
+{
+    uint32_t term;  // Index into the sorted term list
+    uint32_t shift; // 0 .. term length
+};
+
+// Character k of a rotation (k <= term length)
+inline unsigned char rotation_char(const string &term, uint32_t shift, size_t k)
+{
+    size_t i = (shift + k) % (term.size() + 1);
+    return i == term.size() ? PERMUTERM_END : term[i];
+}
+
+// Compare a rotation with key over the key's length only: 0 if the rotation
+// starts with key
+inline int compare_rotation(const string &term, uint32_t shift, const string &key)
+{
+    for (size_t k = 0; k < key.size(); k++)
+    {
+        if (k > term.size())
+            return -1;
+        unsigned char a = rotation_char(term, shift, k), b = key[k];
+        if (a != b)
+            return a < b ? -1 : 1;
+    }
+    return 0;
+}
+
+// Rotation order for sorting the permuterm index
+struct RotationLess
+{
+    const vector<const string *> &terms;
+
+    bool operator()(const PermutermEntry &a, const PermutermEntry &b) const
+    {
+        const string &x = *terms[a.term], &y = *terms[b.term];
+        for (size_t k = 0; k <= x.size() && k <= y.size(); k++)
+        {
+            unsigned char p = rotation_char(x, a.shift, k), q = rotation_char(y, b.shift, k);
+            if (p != q)
+                return p < q;
+        }
+        return x.size() < y.size();
+    }
+};
+
+// Permuterm index of a sorted term list: every rotation of every term, in
+// rotation order, so a pattern X*Y is the range of rotations starting Y$X
+inline vector<PermutermEntry> build_permuterm(const vector<const string *> &terms)
+{
+    vector<PermutermEntry> entries;
+    for (uint32_t t = 0; t < terms.size(); t++)
+    {
+        for (uint32_t shift = 0; shift <= terms[t]->size(); shift++)
+        {
+            entries.push_back(PermutermEntry{t, shift});
+        }
+    }
+    sort(entries.begin(), entries.end(), RotationLess{terms});
+    return entries;
+}
+
+// Glob match of a term against a pattern with * wildcards
+inline bool wildcard_match(const string &pattern, const string &term)
+{
+    size_t p = 0, t = 0, star = string::npos, resume = 0;
+    while (t < term.size())
+    {
+        if (p < pattern.size() && pattern[p] == WILDCARD)
+        {
+            star = p++;
+            resume = t;
+        }
+        else if (p < pattern.size() && pattern[p] == term[t])
+        {
+            p++;
+            t++;
+        }
+        else if (star != string::npos)
+        {
+            p = star + 1;
+            t = ++resume;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == WILDCARD)
+    {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+// Indices (ascending) of the terms matching a pattern that contains at least
+// one *. A trailing * alone takes the binary-searched range of the sorted
+// terms sharing the prefix; any other pattern looks up the permuterm range
+// of its rotation (filtered against the full pattern when stars remain),
+// or scans every term when there is no permuterm index.
+inline void expand_wildcard(const string &pattern, const vector<const string *> &terms,
+                            const vector<PermutermEntry> &permuterm, vector<uint32_t> &matches)
+{
+    matches.clear();
+    size_t first = pattern.find(WILDCARD), last = pattern.rfind(WILDCARD);
+    if (first == string::npos)
+        return;
+
+    if (first == last && last + 1 == pattern.size())
+    {
+        string prefix = pattern.substr(0, first);
+        auto it = lower_bound(terms.begin(), terms.end(), prefix, [](const string *term, const string &key)
+                              { return *term < key; });
+        for (; it != terms.end() && (*it)->compare(0, prefix.size(), prefix) == 0; ++it)
+        {
+            matches.push_back(it - terms.begin());
+        }
+        return;
+    }
+
+    if (permuterm.empty())
+    {
+        for (uint32_t t = 0; t < terms.size(); t++)
+        {
+            if (wildcard_match(pattern, *terms[t]))
+                matches.push_back(t);
+        }
+        return;
+    }
+
+    // X*...*Y rotates to Y$X*; with stars on both ends (*Z*...) the first
+    // inner segment is the key instead, as in Z*. Stars the key does not
+    // cover are checked against the full pattern.
+    string key;
+    bool filter;
+    if (first > 0 || last + 1 < pattern.size())
+    {
+        key = pattern.substr(last + 1) + PERMUTERM_END + pattern.substr(0, first);
+        filter = first != last;
+    }
+    else
+    {
+        size_t begin = pattern.find_first_not_of(WILDCARD);
+        size_t end = begin == string::npos ? begin : pattern.find(WILDCARD, begin);
+        if (begin != string::npos)
+            key = pattern.substr(begin, end - begin);
+        filter = end != last;
+    }
+
+    auto it = lower_bound(permuterm.begin(), permuterm.end(), key, [&](const PermutermEntry &entry, const string &k)
+                          { return compare_rotation(*terms[entry.term], entry.shift, k) < 0; });
+    for (; it != permuterm.end() && compare_rotation(*terms[it->term], it->shift, key) == 0; ++it)
+    {
+        if (!filter || wildcard_match(pattern, *terms[it->term]))
+            matches.push_back(it->term);
+    }
+    sort(matches.begin(), matches.end());
+    matches.erase(unique(matches.begin(), matches.end()), matches.end());
+}
+
+// permuterm.bin layout (little-endian u32): term_count, entry_count, then
+// entry_count x (term, shift) in rotation order; terms index the sorted
+// terms of metadata.json
+inline void write_permuterm_file(const string &path, uint32_t term_count, const vector<PermutermEntry> &entries)
+{
+    ofstream out(path, ios::binary);
+    uint32_t entry_count = entries.size();
+    out.write(reinterpret_cast<const char *>(&term_count), sizeof(uint32_t));
+    out.write(reinterpret_cast<const char *>(&entry_count), sizeof(uint32_t));
+    out.write(reinterpret_cast<const char *>(entries.data()), entry_count * sizeof(PermutermEntry));
+}
+
+// Read permuterm.bin; false if missing or built for a different dictionary
+inline bool read_permuterm_file(const string &path, uint32_t term_count, vector<PermutermEntry> &entries)
+{
+    ifstream in(path, ios::binary);
+    uint32_t stored_terms = 0, entry_count = 0;
+    if (!in.read(reinterpret_cast<char *>(&stored_terms), sizeof(uint32_t)) ||
+        !in.read(reinterpret_cast<char *>(&entry_count), sizeof(uint32_t)) || stored_terms != term_count)
+        return false;
+
+    entries.resize(entry_count);
+    if (!in.read(reinterpret_cast<char *>(entries.data()), entry_count * sizeof(PermutermEntry)))
+    {
+        entries.clear();
+        return false;
+    }
+    for (const PermutermEntry &entry : entries)
+    {
+        if (entry.term >= term_count)
+        {
+            entries.clear();
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,305 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+using namespace std;
+
+// Classes of a word in a WordTable (bit flags: a word may be both a stopword
+// and an operator; the stopword class wins wherever both apply)
+enum WordClass
+{
+    WORD_STOPWORD = 1,
+    WORD_AND = 2,
+    WORD_OR = 4,
+    WORD_NOT = 8
+};
+
+// Finalizer of MurmurHash3: spreads every input bit over the whole word
+inline uint64_t mix_hash(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB93FE1A85A53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Hash of a byte string. Every byte is read through fixed-size loads: 8-byte
+// blocks with the last one overlapping, two overlapping 4-byte loads for 4..7
+// bytes, and first / middle / last byte below that (with the length mixed in,
+// these cover every byte exactly as a byte loop would, without its branches)
+inline uint64_t word_hash(const char *text, size_t length, uint64_t seed)
+{
+    const uint64_t multiplier = 0x9E3779B97F4A7C15ULL;
+    uint64_t h = seed ^ (length * multiplier);
+    uint64_t block = 0;
+    if (length >= 8)
+    {
+        const char *last = text + length - 8;
+        for (; text < last; text += 8)
+        {
+            memcpy(&block, text, 8);
+            h = (h ^ mix_hash(block)) * multiplier;
+        }
+        memcpy(&block, last, 8);
+    }
+    else if (length >= 4)
+    {
+        uint32_t head, tail;
+        memcpy(&head, text, 4);
+        memcpy(&tail, text + length - 4, 4);
+        block = head | (uint64_t)tail << 32;
+    }
+    else if (length > 0)
+    {
+        block = (unsigned char)text[0] | (unsigned char)text[length / 2] << 8 | (unsigned char)text[length - 1] << 16;
+    }
+    return mix_hash(h ^ block);
+}
+
+// Static set of short words with their WordClass flags, stored as a minimal
+// perfect hash (hash and displace): the hash picks a bucket, the bucket's
+// pilot value rehashes it to one of n slots, and no two words share a slot.
+// A lookup is one hash plus one memcmp against the only candidate slot; the
+// reductions to [0, n) are multiplications, not divisions.
+class WordTable
+{
+public:
+    WordTable() : seed_(0), max_length_(0) {}
+
+    // Add a word (classes of repeated words are merged); build() before lookup
+    void add(const string &word, uint8_t classes) { pending_.push_back(make_pair(word, classes)); }
+
+    // Compile the words added so far into the perfect hash
+    void build()
+    {
+        sort(pending_.begin(), pending_.end());
+        vector<pair<string, uint8_t>> words;
+        for (const auto &entry : pending_)
+        {
+            if (!words.empty() && words.back().first == entry.first)
+                words.back().second |= entry.second;
+            else
+                words.push_back(entry);
+        }
+        pending_.clear();
+
+        keys_.clear();
+        slots_.assign(words.size(), Slot());
+        pilots_.clear();
+        max_length_ = 0;
+        for (uint64_t seed = 0x5EED; !words.empty(); seed++)
+        {
+            if (place(words, seed))
+                break;
+        }
+        for (size_t i = 0; i < slots_.size(); i++)
+        {
+            slots_[i].offset = keys_.size();
+            keys_ += words[slots_[i].word].first;
+            slots_[i].value = words[slots_[i].word].second;
+            max_length_ = max(max_length_, slots_[i].length);
+        }
+    }
+
+    // Classes of text[0, length); 0 if not in the table
+    uint8_t lookup(const char *text, size_t length) const
+    {
+        if (slots_.empty() || length > max_length_)
+            return 0;
+        uint64_t h = word_hash(text, length, seed_);
+        const Slot &slot = slots_[slot_of(h, pilots_[bucket_of(h)])];
+        return slot.length == length && memcmp(keys_.data() + slot.offset, text, length) == 0 ? slot.value : 0;
+    }
+
+    uint8_t lookup(const string &word) const { return lookup(word.data(), word.size()); }
+
+    bool is_stopword(const string &word) const { return (lookup(word) & WORD_STOPWORD) != 0; }
+
+    size_t size() const { return slots_.size(); }
+    bool empty() const { return slots_.empty(); }
+
+    // Serialized layout (little-endian): seed u64, word_count u32, key_bytes
+    // u32, pilots (one u32 per bucket), word_count x (offset, length) u32
+    // pairs, word_count class bytes, then the keys. Lookups hash exactly as
+    // when the table was built, so a read table needs no rebuilding.
+    void write(ostream &out) const
+    {
+        uint32_t word_count = slots_.size(), key_bytes = keys_.size();
+        vector<uint32_t> spans;
+        string classes;
+        for (const Slot &slot : slots_)
+        {
+            spans.push_back(slot.offset);
+            spans.push_back(slot.length);
+            classes += (char)slot.value;
+        }
+        out.write(reinterpret_cast<const char *>(&seed_), sizeof(uint64_t));
+        out.write(reinterpret_cast<const char *>(&word_count), sizeof(uint32_t));
+        out.write(reinterpret_cast<const char *>(&key_bytes), sizeof(uint32_t));
+        out.write(reinterpret_cast<const char *>(pilots_.data()), pilots_.size() * sizeof(uint32_t));
+        out.write(reinterpret_cast<const char *>(spans.data()), spans.size() * sizeof(uint32_t));
+        out.write(classes.data(), classes.size());
+        out.write(keys_.data(), keys_.size());
+    }
+
+    // Read a table written by write(); false (table left empty) if truncated
+    // or inconsistent
+    bool read(istream &in)
+    {
+        *this = WordTable();
+        uint32_t word_count = 0, key_bytes = 0;
+        if (!in.read(reinterpret_cast<char *>(&seed_), sizeof(uint64_t)) ||
+            !in.read(reinterpret_cast<char *>(&word_count), sizeof(uint32_t)) ||
+            !in.read(reinterpret_cast<char *>(&key_bytes), sizeof(uint32_t)) || word_count > MAX_WORDS ||
+            key_bytes > MAX_KEY_BYTES)
+            return false;
+
+        vector<uint32_t> spans(2 * word_count);
+        string classes(word_count, '\0');
+        pilots_.resize((word_count + BUCKET_LOAD - 1) / BUCKET_LOAD);
+        keys_.resize(key_bytes);
+        bool ok = in.read(reinterpret_cast<char *>(pilots_.data()), pilots_.size() * sizeof(uint32_t)) &&
+                  in.read(reinterpret_cast<char *>(spans.data()), spans.size() * sizeof(uint32_t)) &&
+                  in.read(&classes[0], classes.size()) && in.read(&keys_[0], keys_.size());
+        slots_.resize(word_count);
+        for (uint32_t i = 0; ok && i < word_count; i++)
+        {
+            Slot &slot = slots_[i];
+            slot.offset = spans[2 * i];
+            slot.length = spans[2 * i + 1];
+            slot.word = i;
+            slot.value = classes[i];
+            ok = slot.offset <= key_bytes && slot.length <= key_bytes - slot.offset;
+            max_length_ = max(max_length_, slot.length);
+        }
+        if (!ok)
+            *this = WordTable();
+        return ok;
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t offset; // Start of the word in keys_
+        uint32_t length;
+        uint32_t word;   // Index of the word while building
+        uint8_t value;
+    };
+
+    // Average words per bucket
+    static const size_t BUCKET_LOAD = 4;
+
+    // Limits accepted by read()
+    static const uint32_t MAX_WORDS = 1 << 24;
+    static const uint32_t MAX_KEY_BYTES = 1 << 28;
+
+    // Pilots tried per bucket before the build starts over with a new seed
+    static const uint32_t MAX_PILOT = 1 << 20;
+
+    // x in [0, 2^32) scaled to [0, n)
+    static size_t reduce(uint64_t x, size_t n) { return (x * n) >> 32; }
+
+    size_t bucket_of(uint64_t h) const { return reduce((uint32_t)h, pilots_.size()); }
+
+    size_t slot_of(uint64_t h, uint32_t pilot) const
+    {
+        uint64_t x = (h ^ (pilot * 0x9E3779B97F4A7C15ULL)) * 0xC4CEB93FE1A85A53ULL;
+        return reduce(x >> 32, slots_.size());
+    }
+
+    // Assign every word a distinct slot, largest buckets first, each bucket
+    // taking the first pilot that lands all its words on free slots; false
+    // if some bucket finds none (then the caller retries with a new seed)
+    bool place(const vector<pair<string, uint8_t>> &words, uint64_t seed)
+    {
+        size_t n = words.size();
+        seed_ = seed;
+        pilots_.assign((n + BUCKET_LOAD - 1) / BUCKET_LOAD, 0);
+        vector<uint64_t> hashes(n);
+        vector<vector<uint32_t>> buckets(pilots_.size());
+        for (uint32_t i = 0; i < n; i++)
+        {
+            hashes[i] = word_hash(words[i].first.data(), words[i].first.size(), seed);
+            buckets[bucket_of(hashes[i])].push_back(i);
+        }
+        vector<uint32_t> order(buckets.size());
+        for (uint32_t b = 0; b < order.size(); b++)
+        {
+            order[b] = b;
+        }
+        stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+                    { return buckets[a].size() > buckets[b].size(); });
+
+        vector<bool> taken(n, false);
+        vector<size_t> chosen;
+        for (uint32_t b : order)
+        {
+            const vector<uint32_t> &bucket = buckets[b];
+            if (bucket.empty())
+                break;
+            uint32_t pilot = 0;
+            for (; pilot < MAX_PILOT; pilot++)
+            {
+                chosen.clear();
+                for (uint32_t word : bucket)
+                {
+                    size_t slot = slot_of(hashes[word], pilot);
+                    if (taken[slot] || find(chosen.begin(), chosen.end(), slot) != chosen.end())
+                        break;
+                    chosen.push_back(slot);
+                }
+                if (chosen.size() == bucket.size())
+                    break;
+            }
+            if (pilot == MAX_PILOT)
+                return false;
+            pilots_[b] = pilot;
+            for (size_t k = 0; k < bucket.size(); k++)
+            {
+                taken[chosen[k]] = true;
+                assign_slot(chosen[k], bucket[k], words);
+            }
+        }
+        return true;
+    }
+
+    void assign_slot(size_t slot, uint32_t word, const vector<pair<string, uint8_t>> &words)
+    {
+        slots_[slot].word = word;
+        slots_[slot].length = words[word].first.size();
+    }
+
+    vector<pair<string, uint8_t>> pending_;
+    uint64_t seed_;
+    string keys_;                         // All words, concatenated in slot order
+    vector<Slot> slots_;                  // n slots for n words
+    vector<uint32_t> pilots_;             // One per bucket
+    uint32_t max_length_;                 // Longer texts are rejected before hashing
+};
+
+// Add the Boolean operator words (lowercase, as the query lexer folds them)
+inline void add_operator_words(WordTable &table)
+{
+    table.add("and", WORD_AND);
+    table.add("or", WORD_OR);
+    table.add("not", WORD_NOT);
+}
+
+// Operator-only table for classifying already split string tokens
+inline const WordTable &operator_words()
+{
+    static const WordTable table = []
+    {
+        WordTable operators;
+        add_operator_words(operators);
+        operators.build();
+        return operators;
+    }();
+    return table;
+}